@@ -1,207 +1,223 @@
 #include "devices/disk.h"
-#include <ctype.h>
 #include <debug.h>
-#include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
+#include "devices/ide.h"
 #include "devices/timer.h"
-#include "threads/io.h"
+#include "devices/virtio-blk.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 
-/* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
-
-/* ATA command block port addresses. */
-#define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
-#define reg_error(CHANNEL) ((CHANNEL)->reg_base + 1)    /* Error. */
-#define reg_nsect(CHANNEL) ((CHANNEL)->reg_base + 2)    /* Sector Count. */
-#define reg_lbal(CHANNEL) ((CHANNEL)->reg_base + 3)     /* LBA 0:7. */
-#define reg_lbam(CHANNEL) ((CHANNEL)->reg_base + 4)     /* LBA 15:8. */
-#define reg_lbah(CHANNEL) ((CHANNEL)->reg_base + 5)     /* LBA 23:16. */
-#define reg_device(CHANNEL) ((CHANNEL)->reg_base + 6)   /* Device/LBA 27:24. */
-#define reg_status(CHANNEL) ((CHANNEL)->reg_base + 7)   /* Status (r/o). */
-#define reg_command(CHANNEL) reg_status (CHANNEL)       /* Command (w/o). */
-
-/* ATA control block port addresses.
-   (If we supported non-legacy ATA controllers this would not be
-   flexible enough, but it's fine for what we do.) */
-#define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
-#define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
-
-/* Alternate Status Register bits. */
-#define STA_BSY 0x80            /* Busy. */
-#define STA_DRDY 0x40           /* Device Ready. */
-#define STA_DRQ 0x08            /* Data Request. */
-
-/* Control Register bits. */
-#define CTL_SRST 0x04           /* Software Reset. */
-
-/* Device Register bits. */
-#define DEV_MBS 0xa0            /* Must be set. */
-#define DEV_LBA 0x40            /* Linear based addressing. */
-#define DEV_DEV 0x10            /* Select device: 0=master, 1=slave. */
-
-/* Commands.
-   Many more are defined but this is the small subset that we
-   use. */
-#define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
-#define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
-#define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
-
-/* An ATA device. */
+/* The code in this file is a generic block device layer.
+   Drivers register each disk they find along with a set of
+   operations, and the rest of the kernel reads and writes disks
+   through the functions here without knowing which driver is
+   behind them. */
+
+/* A block device. */
 struct disk 
   {
-    char name[8];               /* Name, e.g. "hd0:1". */
-    struct channel *channel;    /* Channel disk is on. */
-    int dev_no;                 /* Device 0 or 1 for master or slave. */
-
-    bool is_ata;                /* 1=This device is an ATA disk. */
-    disk_sector_t capacity;     /* Capacity in sectors (if is_ata). */
-
-    long long read_cnt;         /* Number of sectors read. */
-    long long write_cnt;        /* Number of sectors written. */
+    char name[8];               /* Name, e.g. "hd0:1" or "vd0". */
+    disk_sector_t capacity;     /* Capacity in sectors. */
+    const struct disk_operations *ops; /* Driver operations. */
+    void *aux;                  /* Driver data. */
+    struct disk_stats stats;    /* I/O accounting. */
   };
 
-/* An ATA channel (aka controller).
-   Each channel can control up to two disks. */
-struct channel 
+/* Registered disks, in the order found. */
+#define DISK_MAX 8
+static struct disk disks[DISK_MAX];
+static size_t disk_cnt;
+
+/* Names of the disks to use for each role, most preferred first.
+   Virtio disks, where present, are faster than emulated IDE
+   ones, so they are tried first.  A role can be pinned to a
+   particular disk with disk_set_role(). */
+#define ROLE_CHOICES 3
+static const char *role_names[DISK_ROLE_CNT][ROLE_CHOICES] = 
   {
-    char name[8];               /* Name, e.g. "hd0". */
-    uint16_t reg_base;          /* Base I/O port. */
-    uint8_t irq;                /* Interrupt in use. */
-
-    struct lock lock;           /* Must acquire to access the controller. */
-    bool expecting_interrupt;   /* True if an interrupt is expected, false if
-                                   any interrupt would be spurious. */
-    struct semaphore completion_wait;   /* Up'd by interrupt handler. */
-
-    struct disk devices[2];     /* The devices on this channel. */
+    {"vd0", "hd0:1", NULL},     /* DISK_FILESYS. */
+    {"hd1:0", NULL, NULL},      /* DISK_SCRATCH. */
+    {"vd1", "hd1:1", NULL},     /* DISK_SWAP. */
   };
 
-/* We support the two "legacy" ATA channels found in a standard PC. */
-#define CHANNEL_CNT 2
-static struct channel channels[CHANNEL_CNT];
+/* Number of requests disk_read_multiple() and
+   disk_write_multiple() keep in flight at once.  They live on
+   the caller's stack, so keep this small. */
+#define BATCH_MAX 8
 
-static void reset_channel (struct channel *);
-static bool check_device_type (struct disk *);
-static void identify_ata_device (struct disk *);
-
-static void select_sector (struct disk *, disk_sector_t);
-static void issue_pio_command (struct channel *, uint8_t command);
-static void input_sector (struct channel *, void *);
-static void output_sector (struct channel *, const void *);
-
-static void wait_until_idle (const struct disk *);
-static bool wait_while_busy (const struct disk *);
-static void select_device (const struct disk *);
-static void select_device_wait (const struct disk *);
-
-static void interrupt_handler (struct intr_frame *);
+/* Names of the request tags, for printing. */
+static const char *tag_names[DISK_TAG_CNT] = 
+  {
+    "fs", "swap", "flush", "readahead",
+  };
 
-/* Initialize the disk subsystem and detect disks. */
+/* Initializes the disk subsystem and detects disks. */
 void
 disk_init (void) 
 {
-  size_t chan_no;
+  ide_init ();
+  virtio_blk_init ();
+}
 
-  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
-    {
-      struct channel *c = &channels[chan_no];
-      int dev_no;
+/* Prints the average of SUM over CNT requests and the nonzero
+   buckets of HIST, the WHAT times of disk D. */
+static void
+print_disk_hist (struct disk *d, const char *what, long long sum,
+                 long long cnt, const long long hist[DISK_HIST_BUCKETS]) 
+{
+  int i;
 
-      /* Initialize channel. */
-      snprintf (c->name, sizeof c->name, "hd%zu", chan_no);
-      switch (chan_no) 
-        {
-        case 0:
-          c->reg_base = 0x1f0;
-          c->irq = 14 + 0x20;
-          break;
-        case 1:
-          c->reg_base = 0x170;
-          c->irq = 15 + 0x20;
-          break;
-        default:
-          NOT_REACHED ();
-        }
-      lock_init (&c->lock);
-      c->expecting_interrupt = false;
-      sema_init (&c->completion_wait, 0);
- 
-      /* Initialize devices. */
-      for (dev_no = 0; dev_no < 2; dev_no++)
-        {
-          struct disk *d = &c->devices[dev_no];
-          snprintf (d->name, sizeof d->name, "%s:%d", c->name, dev_no);
-          d->channel = c;
-          d->dev_no = dev_no;
+  printf ("%s:   %s %lld us average\n", d->name, what,
+          sum / (cnt > 0 ? cnt : 1));
+  for (i = 0; i < DISK_HIST_BUCKETS; i++)
+    if (hist[i] != 0) 
+      {
+        if (i == DISK_HIST_BUCKETS - 1)
+          printf ("%s:     >= %7lu us: %lld\n", d->name, 1ul << i, hist[i]);
+        else
+          printf ("%s:     < %8lu us: %lld\n",
+                  d->name, 1ul << (i + 1), hist[i]);
+      }
+}
 
-          d->is_ata = false;
-          d->capacity = 0;
+/* Prints statistics for disk D: sectors transferred, bytes per
+   issuer, queue depth, and the service time and latency
+   histograms. */
+static void
+print_disk_stats (struct disk *d) 
+{
+  struct disk_stats s;
+  long long submit_cnt;
+  int tag;
+
+  disk_get_stats (d, &s);
+  printf ("%s: %lld reads, %lld writes\n", d->name, s.read_cnt, s.write_cnt);
+  submit_cnt = s.read_cnt + s.write_cnt + s.depth;
+  if (submit_cnt == 0)
+    return;
+
+  for (tag = 0; tag < DISK_TAG_CNT; tag++)
+    if (s.read_bytes[tag] != 0 || s.write_bytes[tag] != 0)
+      printf ("%s:   %-9s %lld bytes read, %lld bytes written\n",
+              d->name, tag_names[tag], s.read_bytes[tag], s.write_bytes[tag]);
+  printf ("%s:   queue depth %lld.%lld average, %d maximum\n", d->name,
+          s.depth_sum / submit_cnt, s.depth_sum * 10 / submit_cnt % 10,
+          s.max_depth);
+  print_disk_hist (d, "service time", s.service_sum,
+                   s.read_cnt + s.write_cnt, s.service_hist);
+  print_disk_hist (d, "latency", s.latency_sum,
+                   s.read_cnt + s.write_cnt, s.latency_hist);
+}
 
-          d->read_cnt = d->write_cnt = 0;
-        }
+/* Prints disk statistics. */
+void
+disk_print_stats (void) 
+{
+  size_t i;
 
-      /* Register interrupt handler. */
-      intr_register_ext (c->irq, interrupt_handler, c->name);
+  for (i = 0; i < disk_cnt; i++) 
+    print_disk_stats (&disks[i]);
+}
 
-      /* Reset hardware. */
-      reset_channel (c);
+/* Copies disk D's current statistics into *S.  May be called at
+   any time, including while requests are in flight. */
+void
+disk_get_stats (struct disk *d, struct disk_stats *s) 
+{
+  enum intr_level old_level;
 
-      /* Distinguish ATA hard disks from other devices. */
-      if (check_device_type (&c->devices[0]))
-        check_device_type (&c->devices[1]);
+  ASSERT (d != NULL);
 
-      /* Read hard disk identity information. */
-      for (dev_no = 0; dev_no < 2; dev_no++)
-        if (c->devices[dev_no].is_ata)
-          identify_ata_device (&c->devices[dev_no]);
-    }
+  old_level = intr_disable ();
+  *s = d->stats;
+  intr_set_level (old_level);
 }
 
-/* Prints disk statistics. */
-void
-disk_print_stats (void) 
+/* Returns the name of TAG, e.g. "swap". */
+const char *
+disk_tag_name (enum disk_tag tag) 
 {
-  int chan_no;
+  ASSERT (tag < DISK_TAG_CNT);
 
-  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) 
-    {
-      int dev_no;
-
-      for (dev_no = 0; dev_no < 2; dev_no++) 
-        {
-          struct disk *d = disk_get (chan_no, dev_no);
-          if (d != NULL && d->is_ata) 
-            printf ("%s: %lld reads, %lld writes\n",
-                    d->name, d->read_cnt, d->write_cnt);
-        }
-    }
+  return tag_names[tag];
 }
 
-/* Returns the disk numbered DEV_NO--either 0 or 1 for master or
-   slave, respectively--within the channel numbered CHAN_NO.
+/* Returns the IDE disk numbered DEV_NO--either 0 or 1 for master
+   or slave, respectively--within the channel numbered CHAN_NO.
 
    Pintos uses disks this way:
         0:0 - boot loader, command line args, and operating system kernel
         0:1 - file system
         1:0 - scratch
         1:1 - swap
-*/
+   but see disk_get_role(), which also considers faster disks. */
 struct disk *
 disk_get (int chan_no, int dev_no) 
 {
+  char name[8];
+
   ASSERT (dev_no == 0 || dev_no == 1);
 
-  if (chan_no < (int) CHANNEL_CNT) 
+  snprintf (name, sizeof name, "hd%d:%d", chan_no, dev_no);
+  return disk_get_by_name (name);
+}
+
+/* Returns the disk named NAME, or a null pointer if there is no
+   such disk. */
+struct disk *
+disk_get_by_name (const char *name) 
+{
+  size_t i;
+
+  for (i = 0; i < disk_cnt; i++)
+    if (!strcmp (disks[i].name, name))
+      return &disks[i];
+  return NULL;
+}
+
+/* Returns the disk to use for ROLE, or a null pointer if none of
+   the candidates is present. */
+struct disk *
+disk_get_role (enum disk_role role) 
+{
+  size_t i;
+
+  ASSERT (role < DISK_ROLE_CNT);
+
+  for (i = 0; i < ROLE_CHOICES && role_names[role][i] != NULL; i++) 
     {
-      struct disk *d = &channels[chan_no].devices[dev_no];
-      if (d->is_ata)
-        return d; 
+      struct disk *d = disk_get_by_name (role_names[role][i]);
+      if (d != NULL)
+        return d;
     }
   return NULL;
 }
 
+/* Makes the disk named NAME the only candidate for ROLE.  May be
+   called before disk_init().  NAME must stay valid.  Returns
+   false if NAME is too long to be a disk name. */
+bool
+disk_set_role (enum disk_role role, const char *name) 
+{
+  ASSERT (role < DISK_ROLE_CNT);
+
+  if (strlen (name) >= sizeof disks[0].name)
+    return false;
+  role_names[role][0] = name;
+  role_names[role][1] = NULL;
+  return true;
+}
+
+/* Returns disk D's name. */
+const char *
+disk_name (struct disk *d) 
+{
+  ASSERT (d != NULL);
+
+  return d->name;
+}
+
 /* Returns the size of disk D, measured in DISK_SECTOR_SIZE-byte
    sectors. */
 disk_sector_t
@@ -219,21 +235,7 @@ disk_size (struct disk *d)
 void
 disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) 
 {
-  struct channel *c;
-  
-  ASSERT (d != NULL);
-  ASSERT (buffer != NULL);
-
-  c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  d->read_cnt++;
-  lock_release (&c->lock);
+  disk_read_multiple (d, sec_no, 1, buffer, DISK_TAG_FS);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -244,328 +246,227 @@ disk_read (struct disk *d, disk_sector_t sec_no, void *buffer)
 void
 disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer)
 {
-  struct channel *c;
-  
-  ASSERT (d != NULL);
-  ASSERT (buffer != NULL);
-
-  c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  d->write_cnt++;
-  lock_release (&c->lock);
+  disk_write_multiple (d, sec_no, 1, buffer, DISK_TAG_FS);
 }
-
-/* Disk detection and identification. */
-
-static void print_ata_string (char *string, size_t size);
 
-/* Resets an ATA channel and waits for any devices present on it
-   to finish the reset. */
+/* Transfers CNT sectors starting at SEC_NO between disk D and
+   BUFFER, which must have room for CNT * DISK_SECTOR_SIZE bytes,
+   on behalf of TAG, and waits for the transfer to finish.  Runs
+   of adjacent sectors are submitted together so that the driver
+   can issue them as one command. */
 static void
-reset_channel (struct channel *c) 
+transfer_multiple (struct disk *d, disk_sector_t sec_no, size_t cnt,
+                   uint8_t *buffer, bool write, enum disk_tag tag) 
 {
-  bool present[2];
-  int dev_no;
-
-  /* The ATA reset sequence depends on which devices are present,
-     so we start by detecting device presence. */
-  for (dev_no = 0; dev_no < 2; dev_no++)
-    {
-      struct disk *d = &c->devices[dev_no];
+  struct disk_request reqs[BATCH_MAX];
+  struct semaphore done;
 
-      select_device (d);
-
-      outb (reg_nsect (c), 0x55);
-      outb (reg_lbal (c), 0xaa);
-
-      outb (reg_nsect (c), 0xaa);
-      outb (reg_lbal (c), 0x55);
-
-      outb (reg_nsect (c), 0x55);
-      outb (reg_lbal (c), 0xaa);
-
-      present[dev_no] = (inb (reg_nsect (c)) == 0x55
-                         && inb (reg_lbal (c)) == 0xaa);
-    }
-
-  /* Issue soft reset sequence, which selects device 0 as a side effect.
-     Also enable interrupts. */
-  outb (reg_ctl (c), 0);
-  timer_usleep (10);
-  outb (reg_ctl (c), CTL_SRST);
-  timer_usleep (10);
-  outb (reg_ctl (c), 0);
-
-  timer_msleep (150);
-
-  /* Wait for device 0 to clear BSY. */
-  if (present[0]) 
-    {
-      select_device (&c->devices[0]);
-      wait_while_busy (&c->devices[0]); 
-    }
+  ASSERT (intr_get_level () == INTR_ON);
 
-  /* Wait for device 1 to clear BSY. */
-  if (present[1])
+  sema_init (&done, 0);
+  while (cnt > 0) 
     {
-      int i;
+      size_t batch = cnt < BATCH_MAX ? cnt : BATCH_MAX;
+      size_t i;
 
-      select_device (&c->devices[1]);
-      for (i = 0; i < 3000; i++) 
+      for (i = 0; i < batch; i++) 
         {
-          if (inb (reg_nsect (c)) == 1 && inb (reg_lbal (c)) == 1)
-            break;
-          timer_msleep (10);
+          disk_request_init (&reqs[i], d, sec_no + i,
+                             buffer + i * DISK_SECTOR_SIZE, write,
+                             disk_request_wake, &done);
+          reqs[i].tag = tag;
         }
-      wait_while_busy (&c->devices[1]);
+      disk_submit_batch (reqs, batch);
+      for (i = 0; i < batch; i++)
+        sema_down (&done);
+
+      sec_no += batch;
+      buffer += batch * DISK_SECTOR_SIZE;
+      cnt -= batch;
     }
 }
 
-/* Checks whether device D is an ATA disk and sets D's is_ata
-   member appropriately.  If D is device 0 (master), returns true
-   if it's possible that a slave (device 1) exists on this
-   channel.  If D is device 1 (slave), the return value is not
-   meaningful. */
-static bool
-check_device_type (struct disk *d) 
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * DISK_SECTOR_SIZE bytes.  The
+   transfer is accounted to TAG. */
+void
+disk_read_multiple (struct disk *d, disk_sector_t sec_no, size_t cnt,
+                    void *buffer, enum disk_tag tag) 
 {
-  struct channel *c = d->channel;
-  uint8_t error, lbam, lbah, status;
+  transfer_multiple (d, sec_no, cnt, buffer, false, tag);
+}
 
-  select_device (d);
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * DISK_SECTOR_SIZE bytes.  Returns after
+   the disk has acknowledged receiving all of the data.  The
+   transfer is accounted to TAG. */
+void
+disk_write_multiple (struct disk *d, disk_sector_t sec_no, size_t cnt,
+                     const void *buffer, enum disk_tag tag) 
+{
+  transfer_multiple (d, sec_no, cnt, (uint8_t *) buffer, true, tag);
+}
 
-  error = inb (reg_error (c));
-  lbam = inb (reg_lbam (c));
-  lbah = inb (reg_lbah (c));
-  status = inb (reg_status (c));
+/* Initializes R as a request to read (or, if WRITE, to write)
+   sector SEC_NO of disk D to (from) BUFFER, which must have room
+   for DISK_SECTOR_SIZE bytes.  COMPLETE is called with R from
+   interrupt context once the transfer is done; AUX is stored in
+   R for its use.  R is scheduled as synchronous, since usually a
+   thread is waiting for it, whether a read or a write, and is
+   accounted to the file system; callers may change R's prio and
+   tag members before submitting it, e.g. to DISK_PRIO_ASYNC for
+   background write-back that nobody waits on. */
+void
+disk_request_init (struct disk_request *r, struct disk *d,
+                   disk_sector_t sec_no, void *buffer, bool write,
+                   disk_request_func *complete, void *aux)
+{
+  ASSERT (r != NULL);
+  ASSERT (d != NULL);
+  ASSERT (buffer != NULL);
+  ASSERT (complete != NULL);
+  ASSERT (sec_no < d->capacity);
 
-  if ((error != 1 && (error != 0x81 || d->dev_no == 1))
-      || (status & STA_DRDY) == 0
-      || (status & STA_BSY) != 0)
-    {
-      d->is_ata = false;
-      return error != 0x81;      
-    }
-  else 
-    {
-      d->is_ata = (lbam == 0 && lbah == 0) || (lbam == 0x3c && lbah == 0xc3);
-      return true; 
-    }
+  r->disk = d;
+  r->sector = sec_no;
+  r->buffer = buffer;
+  r->write = write;
+  r->prio = DISK_PRIO_SYNC;
+  r->tag = DISK_TAG_FS;
+  r->complete = complete;
+  r->aux = aux;
 }
 
-/* Sends an IDENTIFY DEVICE command to disk D and reads the
-   response.  Initializes D's capacity member based on the result
-   and prints a message describing the disk to the console. */
-static void
-identify_ata_device (struct disk *d) 
+/* Queues R on its disk and returns without waiting for it.  R
+   and its buffer must stay valid until R's completion function
+   is called, which may happen before this function returns.
+   May be called from interrupt context, including from a
+   completion function. */
+void
+disk_submit (struct disk_request *r) 
 {
-  struct channel *c = d->channel;
-  uint16_t id[DISK_SECTOR_SIZE / 2];
-
-  ASSERT (d->is_ata);
-
-  /* Send the IDENTIFY DEVICE command, wait for an interrupt
-     indicating the device's response is ready, and read the data
-     into our buffer. */
-  select_device_wait (d);
-  issue_pio_command (c, CMD_IDENTIFY_DEVICE);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    {
-      d->is_ata = false;
-      return;
-    }
-  input_sector (c, id);
-
-  /* Calculate capacity. */
-  d->capacity = id[60] | ((uint32_t) id[61] << 16);
-
-  /* Print identification message. */
-  printf ("%s: detected %'"PRDSNu" sector (", d->name, d->capacity);
-  if (d->capacity > 1024 / DISK_SECTOR_SIZE * 1024 * 1024)
-    printf ("%"PRDSNu" GB",
-            d->capacity / (1024 / DISK_SECTOR_SIZE * 1024 * 1024));
-  else if (d->capacity > 1024 / DISK_SECTOR_SIZE * 1024)
-    printf ("%"PRDSNu" MB", d->capacity / (1024 / DISK_SECTOR_SIZE * 1024));
-  else if (d->capacity > 1024 / DISK_SECTOR_SIZE)
-    printf ("%"PRDSNu" kB", d->capacity / (1024 / DISK_SECTOR_SIZE));
-  else
-    printf ("%"PRDSNu" byte", d->capacity * DISK_SECTOR_SIZE);
-  printf (") disk, model \"");
-  print_ata_string ((char *) &id[27], 40);
-  printf ("\", serial \"");
-  print_ata_string ((char *) &id[10], 20);
-  printf ("\"\n");
+  disk_submit_batch (r, 1);
 }
 
-/* Prints STRING, which consists of SIZE bytes in a funky format:
-   each pair of bytes is in reverse order.  Does not print
-   trailing whitespace and/or nulls. */
-static void
-print_ata_string (char *string, size_t size) 
+/* Queues the CNT requests in REQS together, as disk_submit()
+   does for one, so that adjacent ones reach the disk as a single
+   command even if it is idle.  All of them must be for the same
+   disk. */
+void
+disk_submit_batch (struct disk_request reqs[], size_t cnt) 
 {
+  struct disk *d;
+  enum intr_level old_level;
+  int64_t now;
   size_t i;
 
-  /* Find the last non-white, non-null character. */
-  for (; size > 0; size--)
+  if (cnt == 0)
+    return;
+
+  d = reqs[0].disk;
+  now = timer_usec ();
+  old_level = intr_disable ();
+  for (i = 0; i < cnt; i++) 
     {
-      int c = string[(size - 1) ^ 1];
-      if (c != '\0' && !isspace (c))
-        break; 
+      ASSERT (reqs[i].disk == d);
+      ASSERT (reqs[i].tag < DISK_TAG_CNT);
+      reqs[i].submit_time = now;
+      /* Until the scheduler sends it to the device. */
+      reqs[i].dispatch_time = now;
+      d->stats.depth++;
+      d->stats.depth_sum += d->stats.depth;
     }
+  if (d->stats.depth > d->stats.max_depth)
+    d->stats.max_depth = d->stats.depth;
+  intr_set_level (old_level);
 
-  /* Print. */
-  for (i = 0; i < size; i++)
-    printf ("%c", string[i ^ 1]);
-}
-
-/* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
-static void
-select_sector (struct disk *d, disk_sector_t sec_no) 
-{
-  struct channel *c = d->channel;
-
-  ASSERT (sec_no < d->capacity);
-  ASSERT (sec_no < (1UL << 28));
-  
-  select_device_wait (d);
-  outb (reg_nsect (c), 1);
-  outb (reg_lbal (c), sec_no);
-  outb (reg_lbam (c), sec_no >> 8);
-  outb (reg_lbah (c), (sec_no >> 16));
-  outb (reg_device (c),
-        DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0) | (sec_no >> 24));
+  d->ops->submit (d->aux, reqs, cnt);
 }
 
-/* Writes COMMAND to channel C and prepares for receiving a
-   completion interrupt. */
-static void
-issue_pio_command (struct channel *c, uint8_t command) 
+/* Completion function that ups the semaphore in R's AUX.
+   Lets a thread submit several requests and then wait for all
+   of them by downing the semaphore once per request. */
+void
+disk_request_wake (struct disk_request *r) 
 {
-  /* Interrupts must be enabled or our semaphore will never be
-     up'd by the completion handler. */
-  ASSERT (intr_get_level () == INTR_ON);
-
-  c->expecting_interrupt = true;
-  outb (reg_command (c), command);
+  sema_up (r->aux);
 }
 
-/* Reads a sector from channel C's data register in PIO mode into
-   SECTOR, which must have room for DISK_SECTOR_SIZE bytes. */
-static void
-input_sector (struct channel *c, void *sector) 
+/* Registers a disk named NAME with CAPACITY sectors, driven by
+   OPS with driver data AUX, and returns it.  Panics if too many
+   disks have been registered. */
+struct disk *
+disk_register (const char *name, disk_sector_t capacity,
+               const struct disk_operations *ops, void *aux) 
 {
-  insw (reg_data (c), sector, DISK_SECTOR_SIZE / 2);
+  struct disk *d;
+
+  if (disk_cnt >= DISK_MAX)
+    PANIC ("too many disks");
+
+  d = &disks[disk_cnt++];
+  strlcpy (d->name, name, sizeof d->name);
+  d->capacity = capacity;
+  d->ops = ops;
+  d->aux = aux;
+  memset (&d->stats, 0, sizeof d->stats);
+  return d;
 }
 
-/* Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain DISK_SECTOR_SIZE bytes. */
-static void
-output_sector (struct channel *c, const void *sector) 
+/* Returns the driver data disk D was registered with. */
+void *
+disk_aux (struct disk *d) 
 {
-  outsw (reg_data (c), sector, DISK_SECTOR_SIZE / 2);
+  return d->aux;
 }
-
-/* Low-level ATA primitives. */
 
-/* Wait up to 10 seconds for the controller to become idle, that
-   is, for the BSY and DRQ bits to clear in the status register.
-
-   As a side effect, reading the status register clears any
-   pending interrupt. */
-static void
-wait_until_idle (const struct disk *d) 
+/* Returns the histogram bucket for a time of US microseconds. */
+static int
+time_bucket (int64_t us) 
 {
-  int i;
+  int bucket = 0;
 
-  for (i = 0; i < 1000; i++) 
+  while (us >= 2 && bucket < DISK_HIST_BUCKETS - 1) 
     {
-      if ((inb (reg_status (d->channel)) & (STA_BSY | STA_DRQ)) == 0)
-        return;
-      timer_usleep (10);
+      us >>= 1;
+      bucket++;
     }
-
-  printf ("%s: idle timeout\n", d->name);
+  return bucket;
 }
 
-/* Wait up to 30 seconds for disk D to clear BSY,
-   and then return the status of the DRQ bit.
-   The ATA standards say that a disk may take as long as that to
-   complete its reset. */
-static bool
-wait_while_busy (const struct disk *d) 
+/* Called by a driver when request R is done: accounts for it and
+   calls its completion function. */
+void
+disk_complete (struct disk_request *r) 
 {
-  struct channel *c = d->channel;
-  int i;
-  
-  for (i = 0; i < 3000; i++)
+  struct disk_stats *s = &r->disk->stats;
+  int64_t now = timer_usec ();
+  int64_t service = now - r->dispatch_time;
+  int64_t latency = now - r->submit_time;
+  enum intr_level old_level;
+
+  if (service < 0)
+    service = 0;
+  if (latency < 0)
+    latency = 0;
+
+  old_level = intr_disable ();
+  if (r->write) 
     {
-      if (i == 700)
-        printf ("%s: busy, waiting...", d->name);
-      if (!(inb (reg_alt_status (c)) & STA_BSY)) 
-        {
-          if (i >= 700)
-            printf ("ok\n");
-          return (inb (reg_alt_status (c)) & STA_DRQ) != 0;
-        }
-      timer_msleep (10);
+      s->write_cnt++;
+      s->write_bytes[r->tag] += DISK_SECTOR_SIZE;
     }
-
-  printf ("failed\n");
-  return false;
-}
-
-/* Program D's channel so that D is now the selected disk. */
-static void
-select_device (const struct disk *d)
-{
-  struct channel *c = d->channel;
-  uint8_t dev = DEV_MBS;
-  if (d->dev_no == 1)
-    dev |= DEV_DEV;
-  outb (reg_device (c), dev);
-  inb (reg_alt_status (c));
-  timer_nsleep (400);
-}
-
-/* Select disk D in its channel, as select_device(), but wait for
-   the channel to become idle before and after. */
-static void
-select_device_wait (const struct disk *d) 
-{
-  wait_until_idle (d);
-  select_device (d);
-  wait_until_idle (d);
-}
-
-/* ATA interrupt handler. */
-static void
-interrupt_handler (struct intr_frame *f) 
-{
-  struct channel *c;
-
-  for (c = channels; c < channels + CHANNEL_CNT; c++)
-    if (f->vec_no == c->irq)
-      {
-        if (c->expecting_interrupt) 
-          {
-            inb (reg_status (c));               /* Acknowledge interrupt. */
-            sema_up (&c->completion_wait);      /* Wake up waiter. */
-          }
-        else
-          printf ("%s: unexpected interrupt\n", c->name);
-        return;
-      }
-
-  NOT_REACHED ();
+  else 
+    {
+      s->read_cnt++;
+      s->read_bytes[r->tag] += DISK_SECTOR_SIZE;
+    }
+  s->depth--;
+  s->service_sum += service;
+  s->service_hist[time_bucket (service)]++;
+  s->latency_sum += latency;
+  s->latency_hist[time_bucket (latency)]++;
+  intr_set_level (old_level);
+
+  r->complete (r);
 }
-
-
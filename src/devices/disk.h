@@ -2,6 +2,9 @@
 #define DEVICES_DISK_H
 
 #include <inttypes.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /* Size of a disk sector in bytes. */
@@ -15,12 +18,131 @@ typedef uint32_t disk_sector_t;
    printf ("sector=%"PRDSNu"\n", sector); */
 #define PRDSNu PRIu32
 
+struct disk_request;
+
+/* Request priority classes, in the order the I/O scheduler
+   prefers them. */
+enum disk_prio
+  {
+    DISK_PRIO_SYNC,             /* A thread is waiting, e.g. page-in. */
+    DISK_PRIO_ASYNC,            /* Background, e.g. write-back. */
+    DISK_PRIO_CNT
+  };
+
+/* Which part of the kernel issued a request, for accounting. */
+enum disk_tag
+  {
+    DISK_TAG_FS,                /* File system, other than below. */
+    DISK_TAG_SWAP,              /* Swap-in and swap-out. */
+    DISK_TAG_FLUSH,             /* Buffer cache write-back. */
+    DISK_TAG_READAHEAD,         /* Speculative reads. */
+    DISK_TAG_CNT
+  };
+
+/* Called when a request completes, usually from interrupt
+   context.  Must not sleep. */
+typedef void disk_request_func (struct disk_request *);
+
+/* An asynchronous request to transfer one sector.
+   Owned by the disk layer from disk_submit() until its
+   completion function is called. */
+struct disk_request
+  {
+    struct list_elem elem;      /* Element in the channel's queue. */
+    struct disk *disk;          /* Disk to transfer to or from. */
+    disk_sector_t sector;       /* Sector number. */
+    void *buffer;               /* DISK_SECTOR_SIZE bytes of data. */
+    bool write;                 /* True to write, false to read. */
+    enum disk_prio prio;        /* Scheduling class. */
+    enum disk_tag tag;          /* Issuer, for accounting. */
+    disk_request_func *complete; /* Completion function. */
+    void *aux;                  /* For use by the completion function. */
+
+    /* Owned by the disk layer. */
+    int64_t submit_time;        /* timer_usec() when submitted. */
+
+    /* Owned by the I/O scheduler. */
+    int64_t dispatch_time;      /* timer_usec() when sent to the device. */
+    struct list_elem sort_elem; /* Element in sector-sorted list. */
+    uint64_t seq;               /* Arrival sequence number. */
+    int64_t deadline;           /* Timer tick to serve it by. */
+  };
+
+/* What the kernel uses a disk for. */
+enum disk_role
+  {
+    DISK_FILESYS,               /* File system. */
+    DISK_SCRATCH,               /* Scratch, for moving files in and out. */
+    DISK_SWAP,                  /* Swap. */
+    DISK_ROLE_CNT
+  };
+
+/* Time histogram buckets.  Bucket 0 counts requests that took
+   less than 2 us, bucket I > 0 those that took [2**I, 2**(I+1)) us,
+   and the last bucket everything slower. */
+#define DISK_HIST_BUCKETS 20
+
+/* I/O accounting for one disk. */
+struct disk_stats
+  {
+    long long read_cnt;         /* Number of sectors read. */
+    long long write_cnt;        /* Number of sectors written. */
+    long long read_bytes[DISK_TAG_CNT];  /* Bytes read, per issuer. */
+    long long write_bytes[DISK_TAG_CNT]; /* Bytes written, per issuer. */
+
+    int depth;                  /* Requests submitted, not completed. */
+    int max_depth;              /* Largest DEPTH seen. */
+    long long depth_sum;        /* Sum of DEPTH seen by each submission. */
+
+    /* Service time runs from dispatch to completion, the time the
+       device took; latency from submission to completion, which
+       includes the time spent queued. */
+    long long service_sum;      /* Total service time, in us. */
+    long long service_hist[DISK_HIST_BUCKETS]; /* Service times. */
+    long long latency_sum;      /* Total latency, in us. */
+    long long latency_hist[DISK_HIST_BUCKETS]; /* Latencies. */
+  };
+
 void disk_init (void);
 void disk_print_stats (void);
+void disk_get_stats (struct disk *, struct disk_stats *);
+const char *disk_tag_name (enum disk_tag);
 
 struct disk *disk_get (int chan_no, int dev_no);
+struct disk *disk_get_by_name (const char *name);
+struct disk *disk_get_role (enum disk_role);
+bool disk_set_role (enum disk_role, const char *name);
+const char *disk_name (struct disk *);
 disk_sector_t disk_size (struct disk *);
 void disk_read (struct disk *, disk_sector_t, void *);
 void disk_write (struct disk *, disk_sector_t, const void *);
+void disk_read_multiple (struct disk *, disk_sector_t, size_t cnt, void *,
+                         enum disk_tag);
+void disk_write_multiple (struct disk *, disk_sector_t, size_t cnt,
+                          const void *, enum disk_tag);
+
+void disk_request_init (struct disk_request *, struct disk *, disk_sector_t,
+                        void *buffer, bool write,
+                        disk_request_func *, void *aux);
+void disk_submit (struct disk_request *);
+void disk_submit_batch (struct disk_request[], size_t cnt);
+void disk_request_wake (struct disk_request *);
+
+/* For disk drivers. */
+
+/* Operations on a disk. */
+struct disk_operations
+  {
+    /* Queues the CNT requests in REQS, which are all for the disk
+       registered with driver data AUX.  Called with interrupts in
+       any state.  The driver calls disk_complete() on each request
+       once it is done, in any order, possibly before returning. */
+    void (*submit) (void *aux, struct disk_request reqs[], size_t cnt);
+  };
+
+struct disk *disk_register (const char *name, disk_sector_t capacity,
+                            const struct disk_operations *, void *aux);
+void *disk_aux (struct disk *);
+void disk_complete (struct disk_request *);
 
 #endif /* devices/disk.h */
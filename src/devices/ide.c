@@ -0,0 +1,880 @@
+#include "devices/ide.h"
+#include <ctype.h>
+#include <debug.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "devices/disk.h"
+#include "devices/iosched.h"
+#include "devices/pci.h"
+#include "devices/timer.h"
+#include "threads/io.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The code in this file is an interface to an ATA (IDE)
+   controller.  It attempts to comply to [ATA-3].  If the
+   controller is a PCI bus-master IDE function (such as the PIIX
+   that QEMU emulates), data is moved by DMA; otherwise it is
+   moved by the CPU in PIO mode. */
+
+/* ATA command block port addresses. */
+#define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
+#define reg_error(CHANNEL) ((CHANNEL)->reg_base + 1)    /* Error. */
+#define reg_nsect(CHANNEL) ((CHANNEL)->reg_base + 2)    /* Sector Count. */
+#define reg_lbal(CHANNEL) ((CHANNEL)->reg_base + 3)     /* LBA 0:7. */
+#define reg_lbam(CHANNEL) ((CHANNEL)->reg_base + 4)     /* LBA 15:8. */
+#define reg_lbah(CHANNEL) ((CHANNEL)->reg_base + 5)     /* LBA 23:16. */
+#define reg_device(CHANNEL) ((CHANNEL)->reg_base + 6)   /* Device/LBA 27:24. */
+#define reg_status(CHANNEL) ((CHANNEL)->reg_base + 7)   /* Status (r/o). */
+#define reg_command(CHANNEL) reg_status (CHANNEL)       /* Command (w/o). */
+
+/* ATA control block port addresses.
+   (If we supported non-legacy ATA controllers this would not be
+   flexible enough, but it's fine for what we do.) */
+#define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
+#define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
+
+/* Bus-master IDE port addresses. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus-master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus-master Status Register bits. */
+#define BM_STA_ERR 0x02         /* Error (write 1 to clear). */
+#define BM_STA_INTR 0x04        /* Interrupt (write 1 to clear). */
+
+/* Alternate Status Register bits. */
+#define STA_BSY 0x80            /* Busy. */
+#define STA_DRDY 0x40           /* Device Ready. */
+#define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
+
+/* Control Register bits. */
+#define CTL_SRST 0x04           /* Software Reset. */
+
+/* Device Register bits. */
+#define DEV_MBS 0xa0            /* Must be set. */
+#define DEV_LBA 0x40            /* Linear based addressing. */
+#define DEV_DEV 0x10            /* Select device: 0=master, 1=slave. */
+
+/* Largest number of adjacent requests issued as one command. */
+#define MERGE_MAX 64
+
+/* Largest number of sectors per interrupt we ask disks for with
+   SET MULTIPLE MODE.  Must be a power of 2. */
+#define MULTIPLE_MAX 16
+
+/* Commands.
+   Many more are defined but this is the small subset that we
+   use. */
+#define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
+#define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
+#define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* A physical region descriptor, telling the bus-master
+   controller where in memory to transfer part of the data.  A
+   region may not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes. */
+    uint16_t flags;             /* PRD_EOT on the last descriptor. */
+  };
+#define PRD_EOT 0x8000
+
+/* Number of descriptors in a channel's one-page PRD table. */
+#define PRDT_CNT (PGSIZE / sizeof (struct prd))
+
+/* An ATA device. */
+struct ata_disk 
+  {
+    char name[8];               /* Name, e.g. "hd0:1". */
+    struct disk *disk;          /* Registered block device, if is_ata. */
+    struct channel *channel;    /* Channel disk is on. */
+    int dev_no;                 /* Device 0 or 1 for master or slave. */
+
+    bool is_ata;                /* 1=This device is an ATA disk. */
+    disk_sector_t capacity;     /* Capacity in sectors (if is_ata). */
+    int multiple;               /* Sectors per interrupt for READ/WRITE
+                                   MULTIPLE, or 0 if not supported. */
+    bool dma;                   /* Supports DMA transfers? */
+  };
+
+/* An ATA channel (aka controller).
+   Each channel can control up to two disks. */
+struct channel 
+  {
+    char name[8];               /* Name, e.g. "hd0". */
+    uint16_t reg_base;          /* Base I/O port. */
+    uint8_t irq;                /* Interrupt in use. */
+    uint16_t bm_base;           /* Bus-master I/O port, 0 if none. */
+    struct prd *prdt;           /* PRD table, if bm_base != 0. */
+
+    /* Request queue.
+       Accessed with interrupts off, since requests are started and
+       completed by the interrupt handler. */
+    struct disk_queue queue;    /* Pending struct disk_requests. */
+    struct list active;         /* Requests in the command in progress,
+                                   in sector order. */
+    size_t block_sectors;       /* Sectors transferred per interrupt by the
+                                   command in progress. */
+    bool dma;                   /* Command in progress uses DMA? */
+
+    bool expecting_interrupt;   /* True if an interrupt is expected, false if
+                                   any interrupt would be spurious. */
+    struct semaphore completion_wait;   /* Up'd by interrupt handler when
+                                           no request is active. */
+
+    struct ata_disk devices[2];     /* The devices on this channel. */
+  };
+
+/* We support the two "legacy" ATA channels found in a standard PC. */
+#define CHANNEL_CNT 2
+static struct channel channels[CHANNEL_CNT];
+
+static void reset_channel (struct channel *);
+static bool check_device_type (struct ata_disk *);
+static void identify_ata_device (struct ata_disk *);
+static void set_multiple_mode (struct ata_disk *, int max);
+static uint16_t find_bus_master (uint8_t *prog_if);
+
+static void select_sector (struct ata_disk *, disk_sector_t, size_t cnt);
+static void issue_pio_command (struct channel *, uint8_t command);
+static void start_request (struct channel *);
+static bool prepare_dma (struct channel *);
+static void finish_dma (struct channel *);
+static void complete_request (struct channel *);
+static void input_sector (struct channel *, void *);
+static void output_sector (struct channel *, const void *);
+static void output_block (struct channel *);
+
+static void wait_until_idle (const struct ata_disk *);
+static bool wait_while_busy (const struct ata_disk *);
+static bool poll_while_busy (const struct ata_disk *);
+static void select_device (const struct ata_disk *);
+static void select_device_wait (const struct ata_disk *);
+
+static void interrupt_handler (struct intr_frame *);
+static void ide_submit (void *aux, struct disk_request[], size_t cnt);
+
+/* Block device operations for ATA disks. */
+static const struct disk_operations ide_operations = 
+  {
+    ide_submit,
+  };
+
+/* Returns the ATA disk that request R is for. */
+static inline struct ata_disk *
+ata_of (const struct disk_request *r) 
+{
+  return disk_aux (r->disk);
+}
+
+/* Detects ATA disks on the legacy IDE channels and registers
+   them as block devices named "hd<channel>:<device>". */
+void
+ide_init (void) 
+{
+  uint8_t prog_if;
+  uint16_t bm_base = find_bus_master (&prog_if);
+  size_t chan_no;
+
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      struct channel *c = &channels[chan_no];
+      int dev_no;
+
+      /* Initialize channel. */
+      snprintf (c->name, sizeof c->name, "hd%zu", chan_no);
+      switch (chan_no) 
+        {
+        case 0:
+          c->reg_base = 0x1f0;
+          c->irq = 14 + 0x20;
+          break;
+        case 1:
+          c->reg_base = 0x170;
+          c->irq = 15 + 0x20;
+          break;
+        default:
+          NOT_REACHED ();
+        }
+      disk_queue_init (&c->queue);
+      list_init (&c->active);
+      c->dma = false;
+
+      /* Set up DMA if there is a bus-master controller.  We only
+         drive the legacy ports, so a channel that the controller
+         has switched to PCI native mode is left to PIO. */
+      c->bm_base = 0;
+      c->prdt = NULL;
+      if (bm_base != 0 && (prog_if & (chan_no == 0 ? 0x01 : 0x04)) == 0)
+        {
+          c->prdt = palloc_get_page (0);
+          if (c->prdt != NULL)
+            c->bm_base = bm_base + chan_no * 8;
+        }
+      c->expecting_interrupt = false;
+      sema_init (&c->completion_wait, 0);
+ 
+      /* Initialize devices. */
+      for (dev_no = 0; dev_no < 2; dev_no++)
+        {
+          struct ata_disk *d = &c->devices[dev_no];
+          snprintf (d->name, sizeof d->name, "hd%zu:%d", chan_no, dev_no);
+          d->channel = c;
+          d->dev_no = dev_no;
+
+          d->is_ata = false;
+          d->capacity = 0;
+          d->multiple = 0;
+          d->dma = false;
+          d->disk = NULL;
+        }
+
+      /* Register interrupt handler. */
+      intr_register_ext (c->irq, interrupt_handler, c->name);
+
+      /* Reset hardware. */
+      reset_channel (c);
+
+      /* Distinguish ATA hard disks from other devices. */
+      if (check_device_type (&c->devices[0]))
+        check_device_type (&c->devices[1]);
+
+      /* Read hard disk identity information and register the
+         disks found. */
+      for (dev_no = 0; dev_no < 2; dev_no++)
+        {
+          struct ata_disk *d = &c->devices[dev_no];
+          if (d->is_ata)
+            identify_ata_device (d);
+          if (d->is_ata)
+            d->disk = disk_register (d->name, d->capacity,
+                                     &ide_operations, d);
+        }
+    }
+}
+
+/* Queues the CNT requests in REQS, all for the disk whose
+   driver data is AUX, on its channel.  Adjacent requests are
+   issued together if the channel is idle. */
+static void
+ide_submit (void *aux, struct disk_request reqs[], size_t cnt) 
+{
+  struct ata_disk *d = aux;
+  struct channel *c = d->channel;
+  enum intr_level old_level;
+  size_t i;
+
+  old_level = intr_disable ();
+  for (i = 0; i < cnt; i++)
+    disk_queue_add (&c->queue, &reqs[i]);
+  start_request (c);
+  intr_set_level (old_level);
+}
+
+/* Disk detection and identification. */
+
+static void print_ata_string (char *string, size_t size);
+
+/* Resets an ATA channel and waits for any devices present on it
+   to finish the reset. */
+static void
+reset_channel (struct channel *c) 
+{
+  bool present[2];
+  int dev_no;
+
+  /* The ATA reset sequence depends on which devices are present,
+     so we start by detecting device presence. */
+  for (dev_no = 0; dev_no < 2; dev_no++)
+    {
+      struct ata_disk *d = &c->devices[dev_no];
+
+      select_device (d);
+
+      outb (reg_nsect (c), 0x55);
+      outb (reg_lbal (c), 0xaa);
+
+      outb (reg_nsect (c), 0xaa);
+      outb (reg_lbal (c), 0x55);
+
+      outb (reg_nsect (c), 0x55);
+      outb (reg_lbal (c), 0xaa);
+
+      present[dev_no] = (inb (reg_nsect (c)) == 0x55
+                         && inb (reg_lbal (c)) == 0xaa);
+    }
+
+  /* Issue soft reset sequence, which selects device 0 as a side effect.
+     Also enable interrupts. */
+  outb (reg_ctl (c), 0);
+  timer_usleep (10);
+  outb (reg_ctl (c), CTL_SRST);
+  timer_usleep (10);
+  outb (reg_ctl (c), 0);
+
+  timer_msleep (150);
+
+  /* Wait for device 0 to clear BSY. */
+  if (present[0]) 
+    {
+      select_device (&c->devices[0]);
+      wait_while_busy (&c->devices[0]); 
+    }
+
+  /* Wait for device 1 to clear BSY. */
+  if (present[1])
+    {
+      int i;
+
+      select_device (&c->devices[1]);
+      for (i = 0; i < 3000; i++) 
+        {
+          if (inb (reg_nsect (c)) == 1 && inb (reg_lbal (c)) == 1)
+            break;
+          timer_msleep (10);
+        }
+      wait_while_busy (&c->devices[1]);
+    }
+}
+
+/* Checks whether device D is an ATA disk and sets D's is_ata
+   member appropriately.  If D is device 0 (master), returns true
+   if it's possible that a slave (device 1) exists on this
+   channel.  If D is device 1 (slave), the return value is not
+   meaningful. */
+static bool
+check_device_type (struct ata_disk *d) 
+{
+  struct channel *c = d->channel;
+  uint8_t error, lbam, lbah, status;
+
+  select_device (d);
+
+  error = inb (reg_error (c));
+  lbam = inb (reg_lbam (c));
+  lbah = inb (reg_lbah (c));
+  status = inb (reg_status (c));
+
+  if ((error != 1 && (error != 0x81 || d->dev_no == 1))
+      || (status & STA_DRDY) == 0
+      || (status & STA_BSY) != 0)
+    {
+      d->is_ata = false;
+      return error != 0x81;      
+    }
+  else 
+    {
+      d->is_ata = (lbam == 0 && lbah == 0) || (lbam == 0x3c && lbah == 0xc3);
+      return true; 
+    }
+}
+
+/* Sends an IDENTIFY DEVICE command to disk D and reads the
+   response.  Initializes D's capacity member based on the result
+   and prints a message describing the disk to the console. */
+static void
+identify_ata_device (struct ata_disk *d) 
+{
+  struct channel *c = d->channel;
+  uint16_t id[DISK_SECTOR_SIZE / 2];
+
+  ASSERT (d->is_ata);
+
+  /* Send the IDENTIFY DEVICE command, wait for an interrupt
+     indicating the device's response is ready, and read the data
+     into our buffer. */
+  select_device_wait (d);
+  issue_pio_command (c, CMD_IDENTIFY_DEVICE);
+  sema_down (&c->completion_wait);
+  if (!wait_while_busy (d))
+    {
+      d->is_ata = false;
+      return;
+    }
+  input_sector (c, id);
+
+  /* Calculate capacity. */
+  d->capacity = id[60] | ((uint32_t) id[61] << 16);
+
+  /* Use DMA if both the disk and the controller support it. */
+  d->dma = (id[49] & 0x100) != 0 && c->bm_base != 0;
+
+  /* Enable READ/WRITE MULTIPLE if the disk supports it. */
+  if ((id[47] & 0xff) > 1)
+    set_multiple_mode (d, id[47] & 0xff);
+
+  /* Print identification message. */
+  printf ("%s: detected %'"PRDSNu" sector (", d->name, d->capacity);
+  if (d->capacity > 1024 / DISK_SECTOR_SIZE * 1024 * 1024)
+    printf ("%"PRDSNu" GB",
+            d->capacity / (1024 / DISK_SECTOR_SIZE * 1024 * 1024));
+  else if (d->capacity > 1024 / DISK_SECTOR_SIZE * 1024)
+    printf ("%"PRDSNu" MB", d->capacity / (1024 / DISK_SECTOR_SIZE * 1024));
+  else if (d->capacity > 1024 / DISK_SECTOR_SIZE)
+    printf ("%"PRDSNu" kB", d->capacity / (1024 / DISK_SECTOR_SIZE));
+  else
+    printf ("%"PRDSNu" byte", d->capacity * DISK_SECTOR_SIZE);
+  printf (") disk%s, model \"", d->dma ? " (DMA)" : "");
+  print_ata_string ((char *) &id[27], 40);
+  printf ("\", serial \"");
+  print_ata_string ((char *) &id[10], 20);
+  printf ("\"\n");
+}
+
+/* Sends a SET MULTIPLE MODE command to disk D asking for the
+   largest power of 2 up to MAX and MULTIPLE_MAX sectors per
+   interrupt, and sets D's multiple member if the disk accepts. */
+static void
+set_multiple_mode (struct ata_disk *d, int max) 
+{
+  struct channel *c = d->channel;
+  int cnt;
+
+  for (cnt = MULTIPLE_MAX; cnt > max; cnt /= 2)
+    continue;
+  if (cnt < 2)
+    return;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), cnt);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if (!(inb (reg_alt_status (c)) & STA_ERR))
+    d->multiple = cnt;
+}
+
+/* Looks for a PCI IDE controller capable of bus mastering,
+   enables it, stores its programming interface byte in *PROG_IF,
+   and returns the base I/O port of its bus-master registers
+   (eight for each channel).  Returns 0 if there is no such
+   controller. */
+static uint16_t
+find_bus_master (uint8_t *prog_if) 
+{
+  struct pci_device pd;
+  uint32_t bar;
+
+  *prog_if = 0;
+  if (!pci_find_class (0x01, 0x01, 0, &pd) || !(pd.prog_if & 0x80))
+    return 0;
+  *prog_if = pd.prog_if;
+
+  bar = pci_bar (&pd, 4);
+  if (!(bar & PCI_BAR_IO) || (bar & PCI_BAR_IO_MASK) == 0)
+    return 0;
+
+  pci_enable (&pd, PCI_CMD_IO | PCI_CMD_MASTER);
+  return bar & PCI_BAR_IO_MASK;
+}
+
+/* Prints STRING, which consists of SIZE bytes in a funky format:
+   each pair of bytes is in reverse order.  Does not print
+   trailing whitespace and/or nulls. */
+static void
+print_ata_string (char *string, size_t size) 
+{
+  size_t i;
+
+  /* Find the last non-white, non-null character. */
+  for (; size > 0; size--)
+    {
+      int c = string[(size - 1) ^ 1];
+      if (c != '\0' && !isspace (c))
+        break; 
+    }
+
+  /* Print. */
+  for (i = 0; i < size; i++)
+    printf ("%c", string[i ^ 1]);
+}
+
+/* Selects device D, waiting for it to become ready, and then
+   writes SEC_NO and the count CNT of sectors to transfer to the
+   disk's sector selection registers.  (We use LBA mode.) */
+static void
+select_sector (struct ata_disk *d, disk_sector_t sec_no, size_t cnt) 
+{
+  struct channel *c = d->channel;
+
+  ASSERT (cnt >= 1 && cnt <= 256);
+  ASSERT (sec_no + cnt <= d->capacity);
+  ASSERT (sec_no + cnt <= (1UL << 28));
+  
+  select_device_wait (d);
+  outb (reg_nsect (c), cnt);
+  outb (reg_lbal (c), sec_no);
+  outb (reg_lbam (c), sec_no >> 8);
+  outb (reg_lbah (c), (sec_no >> 16));
+  outb (reg_device (c),
+        DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0) | (sec_no >> 24));
+}
+
+/* Writes COMMAND to channel C and prepares for receiving a
+   completion interrupt. */
+static void
+issue_pio_command (struct channel *c, uint8_t command) 
+{
+  c->expecting_interrupt = true;
+  outb (reg_command (c), command);
+}
+
+/* If channel C is idle, starts the request that the I/O
+   scheduler picks from C's queue, together with any queued
+   requests that follow it on disk, as a single command.  The
+   disk interrupts once per block of sectors--one sector, or the
+   disk's multiple count with READ/WRITE MULTIPLE: for a read,
+   when the block is ready to be taken; for a write, when the
+   block we handed it is done.  The first block of a write is
+   handed over here.  With DMA, the controller moves all of the
+   data itself and the disk interrupts once, at the end.
+   Interrupts must be off. */
+static void
+start_request (struct channel *c) 
+{
+  struct disk_request *r, *last;
+  struct ata_disk *d;
+  size_t cnt;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!list_empty (&c->active) || disk_queue_empty (&c->queue))
+    return;
+
+  r = last = disk_queue_next (&c->queue);
+  list_push_back (&c->active, &r->elem);
+  for (cnt = 1; cnt < MERGE_MAX; cnt++)
+    {
+      struct disk_request *next = disk_queue_merge (&c->queue, last);
+      if (next == NULL)
+        break;
+      list_push_back (&c->active, &next->elem);
+      last = next;
+    }
+
+  d = ata_of (r);
+  if (prepare_dma (c)) 
+    {
+      select_sector (d, r->sector, cnt);
+      issue_pio_command (c, r->write ? CMD_WRITE_DMA : CMD_READ_DMA);
+      outb (reg_bm_command (c), (r->write ? 0 : BM_CMD_READ) | BM_CMD_START);
+      return;
+    }
+
+  c->block_sectors = cnt > 1 && d->multiple > 1 ? d->multiple : 1;
+  select_sector (d, r->sector, cnt);
+  if (!r->write)
+    issue_pio_command (c, c->block_sectors > 1
+                          ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY);
+  else
+    {
+      issue_pio_command (c, c->block_sectors > 1
+                            ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY);
+      if (!poll_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, r->sector);
+      output_block (c);
+    }
+}
+
+/* Finishes the next block of channel C's command in progress,
+   hands the disk the following block to write or starts the next
+   command, and then notifies the finished requests' owners.
+   Called from the interrupt handler. */
+static void
+complete_request (struct channel *c) 
+{
+  struct disk_request *first = list_entry (list_front (&c->active),
+                                           struct disk_request, elem);
+  struct ata_disk *d = ata_of (first);
+  struct list done;
+  size_t i;
+
+  if (c->dma)
+    finish_dma (c);
+  else if (!first->write && !poll_while_busy (d))
+    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, first->sector);
+
+  list_init (&done);
+  for (i = 0; (c->dma || i < c->block_sectors) && !list_empty (&c->active);
+       i++) 
+    {
+      struct disk_request *r = list_entry (list_pop_front (&c->active),
+                                           struct disk_request, elem);
+      if (!r->write && !c->dma)
+        input_sector (c, r->buffer);
+      list_push_back (&done, &r->elem);
+    }
+
+  if (!list_empty (&c->active)) 
+    {
+      struct disk_request *next = list_entry (list_front (&c->active),
+                                              struct disk_request, elem);
+      if (next->write) 
+        {
+          if (!poll_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, next->sector);
+          output_block (c);
+        }
+    }
+  else
+    {
+      c->expecting_interrupt = false;
+      start_request (c);
+    }
+
+  while (!list_empty (&done)) 
+    {
+      struct disk_request *r = list_entry (list_pop_front (&done),
+                                           struct disk_request, elem);
+      disk_complete (r);
+    }
+}
+
+/* Tries to set up channel C's command in progress for DMA by
+   filling in the PRD table with the buffers of its requests.
+   Returns true if successful, false if the transfer must be done
+   in PIO mode instead. */
+static bool
+prepare_dma (struct channel *c) 
+{
+  struct disk_request *first = list_entry (list_front (&c->active),
+                                           struct disk_request, elem);
+  struct list_elem *e;
+  size_t n = 0;
+
+  c->dma = false;
+  if (c->bm_base == 0 || !ata_of (first)->dma)
+    return false;
+
+  for (e = list_begin (&c->active); e != list_end (&c->active);
+       e = list_next (e))
+    {
+      struct disk_request *r = list_entry (e, struct disk_request, elem);
+      uintptr_t addr;
+      size_t left = DISK_SECTOR_SIZE;
+
+      /* The controller needs physical, word-aligned buffers. */
+      if (!is_kernel_vaddr (r->buffer) || (uintptr_t) r->buffer % 2 != 0)
+        return false;
+      addr = vtop (r->buffer);
+
+      while (left > 0)
+        {
+          /* Split at 64 kB boundaries. */
+          size_t size = 0x10000 - (addr & 0xffff);
+          struct prd *prev = n > 0 ? &c->prdt[n - 1] : NULL;
+          if (size > left)
+            size = left;
+
+          if (prev != NULL && prev->addr + prev->size == addr
+              && (addr & 0xffff) != 0 && prev->size + size < 0x10000)
+            prev->size += size;
+          else
+            {
+              if (n >= PRDT_CNT)
+                return false;
+              c->prdt[n].addr = addr;
+              c->prdt[n].size = size;
+              c->prdt[n].flags = 0;
+              n++;
+            }
+          addr += size;
+          left -= size;
+        }
+    }
+  c->prdt[n - 1].flags = PRD_EOT;
+
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_command (c), first->write ? 0 : BM_CMD_READ);
+  outb (reg_bm_status (c), BM_STA_ERR | BM_STA_INTR);
+  c->dma = true;
+  return true;
+}
+
+/* Stops channel C's bus-master controller after the disk has
+   signaled the end of a DMA transfer, and panics if the transfer
+   failed. */
+static void
+finish_dma (struct channel *c) 
+{
+  uint8_t status = inb (reg_bm_status (c));
+  struct disk_request *first = list_entry (list_front (&c->active),
+                                           struct disk_request, elem);
+
+  outb (reg_bm_command (c), 0);
+  outb (reg_bm_status (c), BM_STA_ERR | BM_STA_INTR);
+  if ((status & BM_STA_ERR) || (inb (reg_alt_status (c)) & STA_ERR))
+    PANIC ("%s: DMA %s failed, sector=%"PRDSNu, ata_of (first)->name,
+           first->write ? "write" : "read", first->sector);
+}
+
+/* Reads a sector from channel C's data register in PIO mode into
+   SECTOR, which must have room for DISK_SECTOR_SIZE bytes. */
+static void
+input_sector (struct channel *c, void *sector) 
+{
+  insw (reg_data (c), sector, DISK_SECTOR_SIZE / 2);
+}
+
+/* Writes SECTOR to channel C's data register in PIO mode.
+   SECTOR must contain DISK_SECTOR_SIZE bytes. */
+static void
+output_sector (struct channel *c, const void *sector) 
+{
+  outsw (reg_data (c), sector, DISK_SECTOR_SIZE / 2);
+}
+
+/* Writes the next block of channel C's command in progress--the
+   buffers of up to block_sectors requests at the front of its
+   active list--to its data register in PIO mode. */
+static void
+output_block (struct channel *c) 
+{
+  struct list_elem *e = list_begin (&c->active);
+  size_t i;
+
+  for (i = 0; i < c->block_sectors && e != list_end (&c->active); i++)
+    {
+      output_sector (c, list_entry (e, struct disk_request, elem)->buffer);
+      e = list_next (e);
+    }
+}
+
+/* Low-level ATA primitives. */
+
+/* Wait up to 10 milliseconds for the controller to become idle,
+   that is, for the BSY and DRQ bits to clear in the status
+   register.  Busy-waits, since start_request() selects the disk
+   with interrupts off.
+
+   As a side effect, reading the status register clears any
+   pending interrupt. */
+static void
+wait_until_idle (const struct ata_disk *d) 
+{
+  int i;
+
+  for (i = 0; i < 1000; i++) 
+    {
+      if ((inb (reg_status (d->channel)) & (STA_BSY | STA_DRQ)) == 0)
+        return;
+      timer_udelay (10);
+    }
+
+  printf ("%s: idle timeout\n", d->name);
+}
+
+/* Wait up to 30 seconds for disk D to clear BSY,
+   and then return the status of the DRQ bit.
+   The ATA standards say that a disk may take as long as that to
+   complete its reset. */
+static bool
+wait_while_busy (const struct ata_disk *d) 
+{
+  struct channel *c = d->channel;
+  int i;
+  
+  for (i = 0; i < 3000; i++)
+    {
+      if (i == 700)
+        printf ("%s: busy, waiting...", d->name);
+      if (!(inb (reg_alt_status (c)) & STA_BSY)) 
+        {
+          if (i >= 700)
+            printf ("ok\n");
+          return (inb (reg_alt_status (c)) & STA_DRQ) != 0;
+        }
+      timer_msleep (10);
+    }
+
+  printf ("failed\n");
+  return false;
+}
+
+/* Like wait_while_busy(), but spins on the status register
+   instead of sleeping, for use with interrupts off, in
+   start_request() and the interrupt handler.  Only used once a
+   command has been issued, when the disk should be ready within
+   microseconds.  Gives up after POLL_MAX reads, each of which
+   takes on the order of a microsecond on the ISA bus. */
+#define POLL_MAX 30000000
+
+static bool
+poll_while_busy (const struct ata_disk *d) 
+{
+  struct channel *c = d->channel;
+  long i;
+
+  for (i = 0; i < POLL_MAX; i++)
+    if (!(inb (reg_alt_status (c)) & STA_BSY))
+      return (inb (reg_alt_status (c)) & STA_DRQ) != 0;
+
+  printf ("%s: busy timeout\n", d->name);
+  return false;
+}
+
+/* Program D's channel so that D is now the selected disk.
+   May be called with interrupts off. */
+static void
+select_device (const struct ata_disk *d)
+{
+  struct channel *c = d->channel;
+  uint8_t dev = DEV_MBS;
+  if (d->dev_no == 1)
+    dev |= DEV_DEV;
+  outb (reg_device (c), dev);
+  inb (reg_alt_status (c));
+  timer_ndelay (400);
+}
+
+/* Select disk D in its channel, as select_device(), but wait for
+   the channel to become idle before and after. */
+static void
+select_device_wait (const struct ata_disk *d) 
+{
+  wait_until_idle (d);
+  select_device (d);
+  wait_until_idle (d);
+}
+
+/* ATA interrupt handler. */
+static void
+interrupt_handler (struct intr_frame *f) 
+{
+  struct channel *c;
+
+  for (c = channels; c < channels + CHANNEL_CNT; c++)
+    if (f->vec_no == c->irq)
+      {
+        if (c->expecting_interrupt) 
+          {
+            inb (reg_status (c));               /* Acknowledge interrupt. */
+            if (!list_empty (&c->active))
+              complete_request (c);             /* Finish request. */
+            else
+              sema_up (&c->completion_wait);    /* Wake up waiter. */
+          }
+        else
+          printf ("%s: unexpected interrupt\n", c->name);
+        return;
+      }
+
+  NOT_REACHED ();
+}
+
+
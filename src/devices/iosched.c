@@ -0,0 +1,233 @@
+#include "devices/iosched.h"
+#include <debug.h>
+#include <string.h>
+#include "devices/timer.h"
+
+/* The code in this file decides the order in which queued disk
+   requests are sent to a channel.
+
+   Requests are split into two classes: synchronous ones, which
+   a thread is blocked on (reads, by default, such as page-ins
+   from a faulting process), and asynchronous ones (write-back
+   of the buffer cache, swap-out).  Every policy dispatches one
+   request at a time; the disk driver then asks for requests that
+   continue it on the disk so that it can issue them together. */
+
+/* How long a request may wait before the deadline policy serves
+   it ahead of everything else, in timer ticks. */
+#define SYNC_EXPIRE (TIMER_FREQ / 2)    /* 500 ms. */
+#define ASYNC_EXPIRE (TIMER_FREQ * 5)   /* 5 s. */
+
+/* An I/O scheduling policy. */
+struct iosched
+  {
+    const char *name;
+    struct disk_request *(*pick) (struct disk_queue *);
+  };
+
+static struct disk_request *noop_pick (struct disk_queue *);
+static struct disk_request *cscan_pick (struct disk_queue *);
+static struct disk_request *deadline_pick (struct disk_queue *);
+
+static const struct iosched policies[] =
+  {
+    {"noop", noop_pick},
+    {"cscan", cscan_pick},
+    {"deadline", deadline_pick},
+  };
+#define POLICY_CNT (sizeof policies / sizeof *policies)
+
+/* Policy in use.  Selected by the "-iosched" kernel option. */
+static const struct iosched *policy = &policies[2];
+
+/* Selects the scheduling policy named NAME.
+   Returns true if successful, false if there is no such policy. */
+bool
+iosched_select (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < POLICY_CNT; i++)
+    if (!strcmp (policies[i].name, name))
+      {
+        policy = &policies[i];
+        return true;
+      }
+  return false;
+}
+
+/* Returns the name of the scheduling policy in use. */
+const char *
+iosched_name (void)
+{
+  return policy->name;
+}
+
+/* Initializes Q as an empty queue. */
+void
+disk_queue_init (struct disk_queue *q)
+{
+  int prio;
+
+  for (prio = 0; prio < DISK_PRIO_CNT; prio++)
+    list_init (&q->fifo[prio]);
+  list_init (&q->sorted);
+  q->head_disk = NULL;
+  q->head_sector = 0;
+  q->seq = 0;
+}
+
+/* Returns true if Q has no pending requests. */
+bool
+disk_queue_empty (struct disk_queue *q)
+{
+  return list_empty (&q->sorted);
+}
+
+/* Returns true if request A comes before request B on disk. */
+static bool
+sector_less (const struct list_elem *a_, const struct list_elem *b_,
+             void *aux UNUSED)
+{
+  const struct disk_request *a = list_entry (a_, struct disk_request,
+                                             sort_elem);
+  const struct disk_request *b = list_entry (b_, struct disk_request,
+                                             sort_elem);
+
+  if (a->disk != b->disk)
+    return a->disk < b->disk;
+  return a->sector < b->sector;
+}
+
+/* Adds R to Q. */
+void
+disk_queue_add (struct disk_queue *q, struct disk_request *r)
+{
+  ASSERT (r->prio < DISK_PRIO_CNT);
+
+  r->seq = q->seq++;
+  r->deadline = timer_ticks ()
+                + (r->prio == DISK_PRIO_SYNC ? SYNC_EXPIRE : ASYNC_EXPIRE);
+  list_push_back (&q->fifo[r->prio], &r->elem);
+  list_insert_ordered (&q->sorted, &r->sort_elem, sector_less, NULL);
+}
+
+/* Removes R from Q and makes it the head position. */
+static struct disk_request *
+dispatch (struct disk_queue *q, struct disk_request *r)
+{
+  list_remove (&r->elem);
+  list_remove (&r->sort_elem);
+  r->dispatch_time = timer_usec ();
+  q->head_disk = r->disk;
+  q->head_sector = r->sector + 1;
+  return r;
+}
+
+/* Removes and returns the request that Q's policy would serve
+   next.  Q must not be empty. */
+struct disk_request *
+disk_queue_next (struct disk_queue *q)
+{
+  ASSERT (!disk_queue_empty (q));
+
+  return dispatch (q, policy->pick (q));
+}
+
+/* If Q holds a request that continues PREV on disk--same disk,
+   same direction, next sector--removes and returns it so that it
+   can be issued in the same command as PREV.  Otherwise returns a
+   null pointer. */
+struct disk_request *
+disk_queue_merge (struct disk_queue *q, const struct disk_request *prev)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&q->sorted); e != list_end (&q->sorted);
+       e = list_next (e))
+    {
+      struct disk_request *r = list_entry (e, struct disk_request, sort_elem);
+      if (r->disk == prev->disk && r->sector == prev->sector + 1
+          && r->write == prev->write)
+        return dispatch (q, r);
+    }
+  return NULL;
+}
+
+/* Noop: serves requests in arrival order, ignoring class. */
+static struct disk_request *
+noop_pick (struct disk_queue *q)
+{
+  struct disk_request *best = NULL;
+  int prio;
+
+  for (prio = 0; prio < DISK_PRIO_CNT; prio++)
+    if (!list_empty (&q->fifo[prio]))
+      {
+        struct disk_request *r = list_entry (list_front (&q->fifo[prio]),
+                                             struct disk_request, elem);
+        if (best == NULL || r->seq < best->seq)
+          best = r;
+      }
+  return best;
+}
+
+/* Returns the first request of class PRIO (or of any class, if
+   PRIO is DISK_PRIO_CNT) at or after Q's head position, wrapping
+   around to the lowest one if there is none.  Returns a null
+   pointer if there is no such request at all. */
+static struct disk_request *
+scan_from_head (struct disk_queue *q, enum disk_prio prio)
+{
+  struct disk_request *first = NULL;
+  struct list_elem *e;
+
+  for (e = list_begin (&q->sorted); e != list_end (&q->sorted);
+       e = list_next (e))
+    {
+      struct disk_request *r = list_entry (e, struct disk_request, sort_elem);
+      if (prio != DISK_PRIO_CNT && r->prio != prio)
+        continue;
+      if (first == NULL)
+        first = r;
+      if (r->disk > q->head_disk
+          || (r->disk == q->head_disk && r->sector >= q->head_sector))
+        return r;
+    }
+  return first;
+}
+
+/* C-SCAN: sweeps upward across the disk and jumps back to the
+   lowest pending sector at the end, ignoring class. */
+static struct disk_request *
+cscan_pick (struct disk_queue *q)
+{
+  return scan_from_head (q, DISK_PRIO_CNT);
+}
+
+/* Deadline: serves an expired request first, synchronous ones
+   before asynchronous ones; otherwise sweeps C-SCAN through the
+   synchronous requests, and only then through the asynchronous
+   ones.  Write-back therefore waits behind page-ins, but never
+   for longer than ASYNC_EXPIRE. */
+static struct disk_request *
+deadline_pick (struct disk_queue *q)
+{
+  int64_t now = timer_ticks ();
+  int prio;
+
+  for (prio = 0; prio < DISK_PRIO_CNT; prio++)
+    if (!list_empty (&q->fifo[prio]))
+      {
+        struct disk_request *r = list_entry (list_front (&q->fifo[prio]),
+                                             struct disk_request, elem);
+        if (now >= r->deadline)
+          return r;
+      }
+
+  for (prio = 0; prio < DISK_PRIO_CNT; prio++)
+    if (!list_empty (&q->fifo[prio]))
+      return scan_from_head (q, prio);
+
+  NOT_REACHED ();
+}
@@ -0,0 +1,31 @@
+#ifndef DEVICES_IOSCHED_H
+#define DEVICES_IOSCHED_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "devices/disk.h"
+
+/* Pending requests on one disk channel, as seen by the I/O
+   scheduler.  Each request is on the FIFO list of its priority
+   class and on a single list sorted by (disk, sector). */
+struct disk_queue
+  {
+    struct list fifo[DISK_PRIO_CNT];    /* Arrival order, per class. */
+    struct list sorted;         /* All requests by disk and sector. */
+    struct disk *head_disk;     /* Disk of the last dispatched request. */
+    disk_sector_t head_sector;  /* Sector just past it. */
+    uint64_t seq;               /* Next arrival sequence number. */
+  };
+
+void disk_queue_init (struct disk_queue *);
+bool disk_queue_empty (struct disk_queue *);
+void disk_queue_add (struct disk_queue *, struct disk_request *);
+struct disk_request *disk_queue_next (struct disk_queue *);
+struct disk_request *disk_queue_merge (struct disk_queue *,
+                                       const struct disk_request *);
+
+bool iosched_select (const char *name);
+const char *iosched_name (void);
+
+#endif /* devices/iosched.h */
@@ -0,0 +1,152 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/* The code in this file reads and writes PCI configuration space
+   through configuration mechanism #1, which every PC chipset
+   since the PCI 2.0 days (and QEMU) implements. */
+
+/* Configuration mechanism #1 ports. */
+#define PCI_CONFIG_ADDR 0xcf8   /* Selects a register (write). */
+#define PCI_CONFIG_DATA 0xcfc   /* Accesses the selected register. */
+
+/* Registers read during a scan. */
+#define PCI_REG_ID 0x00         /* Vendor ID, Device ID. */
+#define PCI_REG_CLASS 0x08      /* Revision, Prog IF, Subclass, Class. */
+#define PCI_REG_HEADER 0x0c     /* Header type in bits 16...23. */
+
+#define PCI_BUS_CNT 256
+#define PCI_DEV_CNT 32
+#define PCI_FUNC_CNT 8
+
+/* Returns the value to write to PCI_CONFIG_ADDR to access
+   register REG of BUS:DEV.FUNC. */
+static uint32_t
+config_addr (int bus, int dev, int func, int reg)
+{
+  ASSERT (reg >= 0 && reg < 256 && reg % 4 == 0);
+  return (0x80000000 | (bus << 16) | (dev << 11) | (func << 8) | reg);
+}
+
+static uint32_t
+read_config (int bus, int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDR, config_addr (bus, dev, func, reg));
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Scans every PCI bus for functions for which MATCH returns true
+   given AUX, and stores the one with index IDX among them (0 for
+   the first) in *PD.  Returns true if there is such a function,
+   false otherwise. */
+static bool
+scan (bool (*match) (const struct pci_device *, const void *aux),
+      const void *aux, int idx, struct pci_device *pd)
+{
+  int bus, dev, func;
+
+  for (bus = 0; bus < PCI_BUS_CNT; bus++)
+    for (dev = 0; dev < PCI_DEV_CNT; dev++)
+      for (func = 0; func < PCI_FUNC_CNT; func++)
+        {
+          uint32_t id = read_config (bus, dev, func, PCI_REG_ID);
+          uint32_t class;
+
+          if ((id & 0xffff) == 0xffff)
+            {
+              /* No such function.  A device without function 0
+                 has no others either. */
+              if (func == 0)
+                break;
+              continue;
+            }
+
+          class = read_config (bus, dev, func, PCI_REG_CLASS);
+          pd->bus = bus;
+          pd->dev = dev;
+          pd->func = func;
+          pd->vendor_id = id & 0xffff;
+          pd->device_id = id >> 16;
+          pd->class = class >> 24;
+          pd->subclass = class >> 16;
+          pd->prog_if = class >> 8;
+          if (match (pd, aux) && idx-- == 0)
+            return true;
+
+          /* Only multi-function devices have functions 1...7. */
+          if (func == 0
+              && !(read_config (bus, dev, 0, PCI_REG_HEADER) & 0x800000))
+            break;
+        }
+  return false;
+}
+
+static bool
+class_matches (const struct pci_device *pd, const void *aux)
+{
+  const uint8_t *class = aux;
+  return pd->class == class[0] && pd->subclass == class[1];
+}
+
+static bool
+id_matches (const struct pci_device *pd, const void *aux)
+{
+  const uint16_t *id = aux;
+  return pd->vendor_id == id[0] && pd->device_id == id[1];
+}
+
+/* Finds the PCI function with index IDX (0 for the first) among
+   those with the given CLASS and SUBCLASS and stores it in *PD.
+   Returns true if successful, false if there is none. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, int idx,
+                struct pci_device *pd)
+{
+  uint8_t aux[2] = {class, subclass};
+  return scan (class_matches, aux, idx, pd);
+}
+
+/* Finds the PCI function with index IDX (0 for the first) among
+   those with the given VENDOR_ID and DEVICE_ID and stores it in
+   *PD.  Returns true if successful, false if there is none. */
+bool
+pci_find_device (uint16_t vendor_id, uint16_t device_id, int idx,
+                 struct pci_device *pd)
+{
+  uint16_t aux[2] = {vendor_id, device_id};
+  return scan (id_matches, aux, idx, pd);
+}
+
+/* Returns the 32-bit configuration register REG of PD, which
+   must be a multiple of 4. */
+uint32_t
+pci_read_config (const struct pci_device *pd, int reg)
+{
+  return read_config (pd->bus, pd->dev, pd->func, reg);
+}
+
+/* Sets the 32-bit configuration register REG of PD, which must
+   be a multiple of 4, to VALUE. */
+void
+pci_write_config (const struct pci_device *pd, int reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDR, config_addr (pd->bus, pd->dev, pd->func, reg));
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Returns base address register BAR_NO (0...5) of PD. */
+uint32_t
+pci_bar (const struct pci_device *pd, int bar_no)
+{
+  ASSERT (bar_no >= 0 && bar_no < 6);
+  return pci_read_config (pd, PCI_REG_BAR0 + bar_no * 4);
+}
+
+/* Sets COMMAND_BITS (PCI_CMD_*) in PD's command register, e.g. to
+   let it act as a bus master. */
+void
+pci_enable (const struct pci_device *pd, uint16_t command_bits)
+{
+  uint32_t command = pci_read_config (pd, PCI_REG_COMMAND);
+  pci_write_config (pd, PCI_REG_COMMAND, command | command_bits);
+}
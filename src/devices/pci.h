@@ -0,0 +1,44 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A PCI function, as found by a bus scan. */
+struct pci_device
+  {
+    uint8_t bus;                /* Bus number. */
+    uint8_t dev;                /* Device number on the bus. */
+    uint8_t func;               /* Function number within the device. */
+    uint16_t vendor_id;         /* Vendor ID. */
+    uint16_t device_id;         /* Device ID. */
+    uint8_t class;              /* Base class, e.g. 0x01 for storage. */
+    uint8_t subclass;           /* Subclass, e.g. 0x01 for IDE. */
+    uint8_t prog_if;            /* Programming interface. */
+  };
+
+/* Configuration space registers. */
+#define PCI_REG_COMMAND 0x04    /* Command (low 16 bits). */
+#define PCI_REG_BAR0 0x10       /* First base address register. */
+#define PCI_REG_IRQ 0x3c        /* Interrupt line (low 8 bits). */
+
+/* Command register bits. */
+#define PCI_CMD_IO 0x0001       /* Respond to I/O space accesses. */
+#define PCI_CMD_MEMORY 0x0002   /* Respond to memory space accesses. */
+#define PCI_CMD_MASTER 0x0004   /* Act as a bus master. */
+
+/* Base address register bits. */
+#define PCI_BAR_IO 0x1          /* I/O space, not memory space. */
+#define PCI_BAR_IO_MASK 0xfffffffc
+
+bool pci_find_class (uint8_t class, uint8_t subclass, int idx,
+                     struct pci_device *);
+bool pci_find_device (uint16_t vendor_id, uint16_t device_id, int idx,
+                      struct pci_device *);
+
+uint32_t pci_read_config (const struct pci_device *, int reg);
+void pci_write_config (const struct pci_device *, int reg, uint32_t value);
+uint32_t pci_bar (const struct pci_device *, int bar_no);
+void pci_enable (const struct pci_device *, uint16_t command_bits);
+
+#endif /* devices/pci.h */
@@ -0,0 +1,75 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/disk.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* The code in this file provides a disk kept in kernel memory,
+   "rd0", for fast scratch space or swap.  Its contents are lost
+   at shutdown.  Requests are carried out and completed as soon as
+   they are submitted. */
+
+#define SECTORS_PER_PAGE (PGSIZE / DISK_SECTOR_SIZE)
+
+/* Pages holding the disk's contents, SECTORS_PER_PAGE sectors
+   each.  The pages need not be contiguous. */
+static uint8_t **pages;
+
+static void ramdisk_submit (void *aux, struct disk_request[], size_t cnt);
+
+/* Block device operations for the RAM disk. */
+static const struct disk_operations ramdisk_operations = 
+  {
+    ramdisk_submit,
+  };
+
+/* Creates and registers a RAM disk of SIZE bytes, rounded up to
+   a whole number of pages.  Does nothing if SIZE is 0. */
+void
+ramdisk_init (size_t size) 
+{
+  size_t page_cnt = DIV_ROUND_UP (size, PGSIZE);
+  size_t i;
+
+  if (page_cnt == 0)
+    return;
+
+  pages = malloc (sizeof *pages * page_cnt);
+  if (pages == NULL)
+    PANIC ("rd0: out of memory");
+  for (i = 0; i < page_cnt; i++)
+    {
+      pages[i] = palloc_get_page (PAL_ZERO);
+      if (pages[i] == NULL)
+        PANIC ("rd0: out of memory after %zu of %zu kB",
+               i * PGSIZE / 1024, page_cnt * PGSIZE / 1024);
+    }
+
+  printf ("rd0: %zu kB RAM disk\n", page_cnt * PGSIZE / 1024);
+  disk_register ("rd0", page_cnt * SECTORS_PER_PAGE,
+                 &ramdisk_operations, NULL);
+}
+
+/* Carries out and completes the CNT requests in REQS. */
+static void
+ramdisk_submit (void *aux UNUSED, struct disk_request reqs[], size_t cnt) 
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct disk_request *r = &reqs[i];
+      uint8_t *sector = (pages[r->sector / SECTORS_PER_PAGE]
+                         + r->sector % SECTORS_PER_PAGE * DISK_SECTOR_SIZE);
+
+      if (r->write)
+        memcpy (sector, r->buffer, DISK_SECTOR_SIZE);
+      else
+        memcpy (r->buffer, sector, DISK_SECTOR_SIZE);
+      disk_complete (r);
+    }
+}
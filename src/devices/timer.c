@@ -24,9 +24,15 @@
 #error TIMER_FREQ <= 1000 recommended
 #endif
 
+/* Input frequency of the 8254, in Hz. */
+#define PIT_HZ 1193180
+
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* 8254 counter reload value, i.e. PIT_HZ / TIMER_FREQ. */
+static uint16_t pit_count;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
@@ -35,6 +41,7 @@ static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
+static void real_time_delay (int64_t num, int32_t denom);
 
 /* Sets up the 8254 Programmable Interval Timer (PIT) to
    interrupt PIT_FREQ times per second, and registers the
@@ -44,11 +51,12 @@ timer_init (void)
 {
   /* 8254 input frequency divided by TIMER_FREQ, rounded to
      nearest. */
-  uint16_t count = (1193180 + TIMER_FREQ / 2) / TIMER_FREQ;
+  uint16_t count = (PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ;
 
   outb (0x43, 0x34);    /* CW: counter 0, LSB then MSB, mode 2, binary. */
   outb (0x40, count & 0xff);
   outb (0x40, count >> 8);
+  pit_count = count;
 
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
@@ -99,6 +107,31 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
+/* Returns the number of microseconds since the OS booted, with
+   finer resolution than timer_ticks() because the 8254's current
+   count within the tick is taken into account.  If the counter
+   has just wrapped around and the timer interrupt is still
+   pending, the result may be up to one tick early, so callers
+   that take differences should treat negative ones as zero. */
+int64_t
+timer_usec (void)
+{
+  enum intr_level old_level = intr_disable ();
+  unsigned count;
+  int64_t t;
+
+  outb (0x43, 0x00);    /* CW: latch counter 0. */
+  count = inb (0x40);
+  count |= inb (0x40) << 8;
+  t = ticks;
+  intr_set_level (old_level);
+
+  if (count > pit_count)
+    count = pit_count;
+  return (t * (1000 * 1000 / TIMER_FREQ)
+          + (int64_t) (pit_count - count) * 1000 * 1000 / PIT_HZ);
+}
+
 /* Suspends execution for approximately TICKS timer ticks. */
 void
 timer_sleep (int64_t ticks)
@@ -136,6 +169,27 @@ timer_nsleep (int64_t ns)
   real_time_sleep (ns, 1000 * 1000 * 1000);
 }
 
+/* Busy-waits for approximately US microseconds.  Interrupts
+   need not be turned on.
+
+   Busy waiting wastes CPU cycles, and busy waiting with
+   interrupts off for the interval between timer ticks or longer
+   will cause timer ticks to be lost.  Thus, use timer_usleep()
+   instead if interrupts are enabled. */
+void
+timer_udelay (int64_t us)
+{
+  real_time_delay (us, 1000 * 1000);
+}
+
+/* Busy-waits for approximately NS nanoseconds.  Interrupts need
+   not be turned on.  See timer_udelay(). */
+void
+timer_ndelay (int64_t ns)
+{
+  real_time_delay (ns, 1000 * 1000 * 1000);
+}
+
 /* Prints timer statistics. */
 void
 timer_print_stats (void)
@@ -239,7 +293,16 @@ real_time_sleep (int64_t num, int32_t denom)
       /* Otherwise, use a busy-wait loop for more accurate
          sub-tick timing.  We scale the numerator and denominator
          down by 1000 to avoid the possibility of overflow. */
-      ASSERT (denom % 1000 == 0);
-      busy_wait (loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000));
+      real_time_delay (num, denom);
     }
 }
+
+/* Busy-wait for approximately NUM/DENOM seconds. */
+static void
+real_time_delay (int64_t num, int32_t denom)
+{
+  /* Scale the numerator and denominator down by 1000 to avoid
+     the possibility of overflow. */
+  ASSERT (denom % 1000 == 0);
+  busy_wait (loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000));
+}
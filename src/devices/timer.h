@@ -12,12 +12,17 @@ void timer_calibrate (void);
 
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
+int64_t timer_usec (void);
 
 void timer_sleep (int64_t ticks);
 void timer_msleep (int64_t milliseconds);
 void timer_usleep (int64_t microseconds);
 void timer_nsleep (int64_t nanoseconds);
 
+/* Busy waits, usable with interrupts off. */
+void timer_udelay (int64_t microseconds);
+void timer_ndelay (int64_t nanoseconds);
+
 void timer_print_stats (void);
 
 #endif /* devices/timer.h */
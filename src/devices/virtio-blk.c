@@ -0,0 +1,415 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
+#include "devices/disk.h"
+#include "devices/iosched.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The code in this file drives virtio block devices through the
+   legacy (virtio 0.9.5) PCI interface, as provided by QEMU's
+   "-drive if=virtio".  Requests are handed to the device through
+   a ring of descriptors in shared memory (a "virtqueue"), so many
+   can be in flight at once, and a run of adjacent sectors becomes
+   a single vectored request with one descriptor per buffer. */
+
+#define VIRTIO_VENDOR_ID 0x1af4
+#define VIRTIO_BLK_DEVICE_ID 0x1001     /* Legacy block device. */
+
+/* Legacy virtio PCI port addresses, relative to BAR0. */
+#define reg_features(DEV) ((DEV)->io_base + 0x00)       /* Features. */
+#define reg_guest_features(DEV) ((DEV)->io_base + 0x04) /* Accepted. */
+#define reg_queue_pfn(DEV) ((DEV)->io_base + 0x08)      /* Ring page. */
+#define reg_queue_size(DEV) ((DEV)->io_base + 0x0c)     /* Ring size. */
+#define reg_queue_select(DEV) ((DEV)->io_base + 0x0e)   /* Ring select. */
+#define reg_queue_notify(DEV) ((DEV)->io_base + 0x10)   /* Kick ring. */
+#define reg_status(DEV) ((DEV)->io_base + 0x12)         /* Status. */
+#define reg_isr(DEV) ((DEV)->io_base + 0x13)            /* ISR (r/o). */
+#define reg_capacity(DEV) ((DEV)->io_base + 0x14)       /* Capacity. */
+
+/* Device Status Register bits. */
+#define STA_ACKNOWLEDGE 0x01    /* Guest has seen the device. */
+#define STA_DRIVER 0x02         /* Guest has a driver for it. */
+#define STA_DRIVER_OK 0x04      /* Driver is ready. */
+
+/* ISR Register bits. */
+#define ISR_QUEUE 0x01          /* A virtqueue has used buffers. */
+
+/* A descriptor: one buffer in a chain making up a request. */
+struct vring_desc
+  {
+    uint64_t addr;              /* Physical address. */
+    uint32_t len;               /* Length in bytes. */
+    uint16_t flags;             /* VRING_DESC_F_*. */
+    uint16_t next;              /* Next descriptor, if F_NEXT. */
+  };
+#define VRING_DESC_F_NEXT 1     /* Chain continues in next. */
+#define VRING_DESC_F_WRITE 2    /* Device writes (vs. reads) buffer. */
+
+/* Ring of chains offered to the device. */
+struct vring_avail
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where we put the next entry. */
+    uint16_t ring[];            /* First descriptors of chains. */
+  };
+
+/* Ring of chains the device is done with. */
+struct vring_used_elem
+  {
+    uint32_t id;                /* First descriptor of chain. */
+    uint32_t len;               /* Bytes written into the chain. */
+  };
+
+struct vring_used
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the device puts the next entry. */
+    struct vring_used_elem ring[];
+  };
+
+/* Block request header, the first buffer of every chain. */
+struct virtio_blk_header
+  {
+    uint32_t type;              /* VIRTIO_BLK_T_*. */
+    uint32_t reserved;
+    uint64_t sector;            /* First sector. */
+  };
+#define VIRTIO_BLK_T_IN 0       /* Read. */
+#define VIRTIO_BLK_T_OUT 1      /* Write. */
+#define VIRTIO_BLK_S_OK 0       /* Status byte: success. */
+
+/* A command in flight, indexed by its first descriptor. */
+struct command
+  {
+    struct virtio_blk_header header;    /* Read by the device. */
+    uint8_t status;                     /* Written by the device. */
+    struct list requests;               /* struct disk_requests. */
+  };
+
+/* Largest number of adjacent requests issued as one command. */
+#define MERGE_MAX 64
+
+/* A virtio block device. */
+struct vblk
+  {
+    char name[8];               /* Name, e.g. "vd0". */
+    uint16_t io_base;           /* Base I/O port. */
+    uint8_t irq;                /* Interrupt vector in use. */
+
+    /* Virtqueue, shared with the device. */
+    uint16_t queue_size;        /* Number of descriptors. */
+    struct vring_desc *desc;    /* Descriptor table. */
+    struct vring_avail *avail;  /* Available ring. */
+    struct vring_used *used;    /* Used ring. */
+
+    /* Accessed with interrupts off. */
+    uint16_t free_head;         /* First free descriptor. */
+    uint16_t free_cnt;          /* Number of free descriptors. */
+    uint16_t last_used;         /* Used ring entries consumed so far. */
+    struct command *commands;   /* Commands in flight. */
+    struct disk_queue queue;    /* Requests not yet given to the device. */
+  };
+
+#define VBLK_MAX 4
+static struct vblk vblks[VBLK_MAX];
+static size_t vblk_cnt;
+
+static bool setup_device (struct vblk *, const struct pci_device *);
+static void vblk_submit (void *aux, struct disk_request[], size_t cnt);
+static void start_requests (struct vblk *);
+static void interrupt_handler (struct intr_frame *);
+
+/* Block device operations for virtio disks. */
+static const struct disk_operations vblk_operations = 
+  {
+    vblk_submit,
+  };
+
+/* Detects virtio block devices and registers them as block
+   devices named "vd0", "vd1", and so on. */
+void
+virtio_blk_init (void) 
+{
+  struct pci_device pd;
+  int idx;
+
+  for (idx = 0; vblk_cnt < VBLK_MAX
+         && pci_find_device (VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID, idx, &pd);
+       idx++)
+    {
+      struct vblk *v = &vblks[vblk_cnt];
+      snprintf (v->name, sizeof v->name, "vd%zu", vblk_cnt);
+      if (setup_device (v, &pd))
+        vblk_cnt++;
+    }
+}
+
+/* A virtqueue with SIZE descriptors is laid out as the legacy
+   interface requires: the descriptor table, then the available
+   ring, then the used ring on the next page boundary.  These
+   return the offset of the used ring and the total size. */
+static size_t
+vring_used_offset (uint16_t size) 
+{
+  return ROUND_UP (sizeof (struct vring_desc) * size
+                   + sizeof (uint16_t) * (3 + size), PGSIZE);
+}
+
+static size_t
+vring_size (uint16_t size) 
+{
+  return (vring_used_offset (size)
+          + sizeof (uint16_t) * 3 + sizeof (struct vring_used_elem) * size);
+}
+
+/* Initializes V for the device PD: resets it, sets up its
+   virtqueue, and registers it.  Returns true if successful,
+   false if V cannot be used. */
+static bool
+setup_device (struct vblk *v, const struct pci_device *pd) 
+{
+  uint32_t bar = pci_bar (pd, 0);
+  uint8_t irq = pci_read_config (pd, PCI_REG_IRQ) & 0xff;
+  uint64_t capacity;
+  size_t i;
+  uint8_t *mem;
+
+  if (!(bar & PCI_BAR_IO) || irq >= 16)
+    return false;
+  v->io_base = bar & PCI_BAR_IO_MASK;
+  v->irq = irq + 0x20;
+  pci_enable (pd, PCI_CMD_IO | PCI_CMD_MASTER);
+
+  /* Reset the device and tell it we drive it.  We need none of
+     the optional features. */
+  outb (reg_status (v), 0);
+  outb (reg_status (v), STA_ACKNOWLEDGE);
+  outb (reg_status (v), STA_ACKNOWLEDGE | STA_DRIVER);
+  outl (reg_guest_features (v), 0);
+
+  /* Set up the request virtqueue, whose size the device picks. */
+  outw (reg_queue_select (v), 0);
+  v->queue_size = inw (reg_queue_size (v));
+  if (v->queue_size == 0)
+    return false;
+  mem = palloc_get_multiple (PAL_ZERO,
+                             DIV_ROUND_UP (vring_size (v->queue_size), PGSIZE));
+  v->commands = malloc (sizeof *v->commands * v->queue_size);
+  if (mem == NULL || v->commands == NULL)
+    PANIC ("%s: out of memory for virtqueue", v->name);
+  v->desc = (struct vring_desc *) mem;
+  v->avail = (struct vring_avail *) (mem + sizeof (struct vring_desc)
+                                           * v->queue_size);
+  v->used = (struct vring_used *) (mem + vring_used_offset (v->queue_size));
+  for (i = 0; i < v->queue_size; i++)
+    v->desc[i].next = i + 1;
+  v->free_head = 0;
+  v->free_cnt = v->queue_size;
+  v->last_used = 0;
+  disk_queue_init (&v->queue);
+  outl (reg_queue_pfn (v), vtop (mem) >> PGBITS);
+
+  /* Share interrupt handlers among devices on the same line. */
+  for (i = 0; i < vblk_cnt; i++)
+    if (vblks[i].irq == v->irq)
+      break;
+  if (i == vblk_cnt)
+    intr_register_ext (v->irq, interrupt_handler, "virtio-blk");
+
+  outb (reg_status (v), STA_ACKNOWLEDGE | STA_DRIVER | STA_DRIVER_OK);
+
+  capacity = inl (reg_capacity (v));
+  capacity |= (uint64_t) inl (reg_capacity (v) + 4) << 32;
+  if (capacity > UINT32_MAX)
+    capacity = UINT32_MAX;
+  printf ("%s: detected %'"PRDSNu" sector virtio disk\n",
+          v->name, (disk_sector_t) capacity);
+  disk_register (v->name, capacity, &vblk_operations, v);
+  return true;
+}
+
+/* Queues the CNT requests in REQS for the device whose driver
+   data is AUX and hands as many as fit to the device. */
+static void
+vblk_submit (void *aux, struct disk_request reqs[], size_t cnt) 
+{
+  struct vblk *v = aux;
+  enum intr_level old_level;
+  size_t i;
+
+  old_level = intr_disable ();
+  for (i = 0; i < cnt; i++)
+    {
+      ASSERT (is_kernel_vaddr (reqs[i].buffer));
+      disk_queue_add (&v->queue, &reqs[i]);
+    }
+  start_requests (v);
+  intr_set_level (old_level);
+}
+
+/* Takes a free descriptor from V's table and fills it in to
+   describe SIZE bytes at kernel virtual address BUFFER.  If PREV
+   is not a null pointer, chains it after *PREV. */
+static uint16_t
+add_desc (struct vblk *v, struct vring_desc *prev, const void *buffer,
+          size_t size, uint16_t flags) 
+{
+  uint16_t idx = v->free_head;
+  struct vring_desc *desc = &v->desc[idx];
+
+  ASSERT (v->free_cnt > 0);
+  v->free_head = desc->next;
+  v->free_cnt--;
+
+  desc->addr = vtop (buffer);
+  desc->len = size;
+  desc->flags = flags;
+  if (prev != NULL)
+    {
+      prev->flags |= VRING_DESC_F_NEXT;
+      prev->next = idx;
+    }
+  return idx;
+}
+
+/* Hands queued requests to device V, in the order the I/O
+   scheduler picks them and merged with queued requests that
+   follow them on disk, for as long as there are descriptors
+   free.  Interrupts must be off. */
+static void
+start_requests (struct vblk *v) 
+{
+  bool started = false;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (!disk_queue_empty (&v->queue) && v->free_cnt >= 3)
+    {
+      struct disk_request *r = disk_queue_next (&v->queue);
+      struct disk_request *last = r;
+      size_t limit = v->free_cnt - 2 < MERGE_MAX ? v->free_cnt - 2 : MERGE_MAX;
+      uint16_t head = v->free_head;
+      struct command *cmd = &v->commands[head];
+      struct vring_desc *prev;
+      uint16_t data_flags;
+      size_t cnt;
+
+      /* Header. */
+      cmd->header.type = r->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+      cmd->header.reserved = 0;
+      cmd->header.sector = r->sector;
+      cmd->status = 0xff;
+      list_init (&cmd->requests);
+      prev = &v->desc[add_desc (v, NULL, &cmd->header, sizeof cmd->header, 0)];
+
+      /* Data, one descriptor per request, or per run of requests
+         whose buffers are physically contiguous. */
+      data_flags = r->write ? 0 : VRING_DESC_F_WRITE;
+      for (cnt = 0; r != NULL; cnt++)
+        {
+          uint8_t *end = (uint8_t *) last->buffer + DISK_SECTOR_SIZE;
+          if (cnt > 0 && r->buffer == end
+              && prev->len + DISK_SECTOR_SIZE <= PGSIZE)
+            prev->len += DISK_SECTOR_SIZE;
+          else
+            prev = &v->desc[add_desc (v, prev, r->buffer, DISK_SECTOR_SIZE,
+                                      data_flags)];
+          list_push_back (&cmd->requests, &r->elem);
+          last = r;
+          r = cnt + 1 < limit ? disk_queue_merge (&v->queue, last) : NULL;
+        }
+
+      /* Status. */
+      add_desc (v, prev, &cmd->status, 1, VRING_DESC_F_WRITE);
+
+      v->avail->ring[v->avail->idx % v->queue_size] = head;
+      barrier ();
+      v->avail->idx++;
+      started = true;
+    }
+
+  if (started)
+    {
+      barrier ();
+      outw (reg_queue_notify (v), 0);
+    }
+}
+
+/* Returns the descriptor chain starting at HEAD to V's free
+   list. */
+static void
+free_chain (struct vblk *v, uint16_t head) 
+{
+  uint16_t idx = head;
+
+  for (;;)
+    {
+      struct vring_desc *desc = &v->desc[idx];
+      bool more = desc->flags & VRING_DESC_F_NEXT;
+      uint16_t next = desc->next;
+
+      desc->next = v->free_head;
+      v->free_head = idx;
+      v->free_cnt++;
+      if (!more)
+        break;
+      idx = next;
+    }
+}
+
+/* Retires the commands that device V has finished, starts queued
+   requests in the descriptors freed, and then completes the
+   finished requests.  Called from the interrupt handler. */
+static void
+complete_requests (struct vblk *v) 
+{
+  struct list done;
+
+  list_init (&done);
+  while (v->last_used != v->used->idx)
+    {
+      struct vring_used_elem *e;
+      struct command *cmd;
+
+      barrier ();
+      e = &v->used->ring[v->last_used % v->queue_size];
+      cmd = &v->commands[e->id];
+      if (cmd->status != VIRTIO_BLK_S_OK)
+        PANIC ("%s: request failed, sector=%"PRIu64, v->name,
+               cmd->header.sector);
+      while (!list_empty (&cmd->requests))
+        list_push_back (&done, list_pop_front (&cmd->requests));
+      free_chain (v, e->id);
+      v->last_used++;
+    }
+
+  start_requests (v);
+
+  while (!list_empty (&done))
+    disk_complete (list_entry (list_pop_front (&done),
+                               struct disk_request, elem));
+}
+
+/* Virtio block interrupt handler. */
+static void
+interrupt_handler (struct intr_frame *f) 
+{
+  size_t i;
+
+  for (i = 0; i < vblk_cnt; i++)
+    {
+      struct vblk *v = &vblks[i];
+
+      /* Reading the ISR acknowledges the interrupt. */
+      if (v->irq == f->vec_no && (inb (reg_isr (v)) & ISR_QUEUE))
+        complete_requests (v);
+    }
+}
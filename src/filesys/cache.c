@@ -1,5 +1,6 @@
 #include "filesys/cache.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
 #include "userprog/pagedir.h"
@@ -12,6 +13,7 @@ void cache_table_init(void) {
   // initialize cache table members
   list_init(&cache_table.list);
   lock_init(&cache_table.lock);
+  lock_init(&cache_table.flush_io);
   cache_table.size = 0;
   cache_table.destroyed = 0;
 
@@ -19,6 +21,35 @@ void cache_table_init(void) {
   thread_create("flush", PRI_DEFAULT, cache_table_thread, NULL);
 }
 
+/* Queues one request per sector of file system block BLOCK, to or
+   from BUFFER, into REQS, each waking DONE when finished.  They are
+   submitted together so that the block goes to disk in one command.
+   Writes are periodic write-back, so they yield to requests that
+   threads are waiting on. */
+static void cache_block_submit(disk_sector_t block, uint8_t *buffer, struct disk_request *reqs,
+                               bool write, struct semaphore *done) {
+  unsigned i;
+  for (i=0; i<fs_block_sectors; i++) {
+    disk_request_init(&reqs[i], filesys_disk, block + i, buffer + i * DISK_SECTOR_SIZE,
+                      write, disk_request_wake, done);
+    if (write) {
+      reqs[i].tag = DISK_TAG_FLUSH;
+      reqs[i].prio = DISK_PRIO_ASYNC;
+    }
+  }
+  disk_submit_batch(reqs, fs_block_sectors);
+}
+
+/* Reads every sector of the block cached in CTE from disk. */
+void cache_block_read(struct cache_table_entry *cte) {
+  disk_read_multiple(filesys_disk, cte->block, fs_block_sectors, cte->vaddr, DISK_TAG_FS);
+}
+
+/* Writes every sector of the block cached in CTE to disk. */
+void cache_block_write(struct cache_table_entry *cte) {
+  disk_write_multiple(filesys_disk, cte->block, fs_block_sectors, cte->vaddr, DISK_TAG_FLUSH);
+}
+
 struct cache_table_entry *cache_table_find(disk_sector_t block) {
 
   struct list_elem *e;
@@ -36,7 +67,8 @@ struct cache_table_entry *allocate_cache(disk_sector_t block) {
   // should be guaranteed that the entry with block does not exist
   struct cache_table_entry *cte = (struct cache_table_entry *)malloc(sizeof(struct cache_table_entry));
   cte->block = block;
-  cte->vaddr = (uint8_t *)malloc(DISK_SECTOR_SIZE);
+  cte->vaddr = (uint8_t *)malloc(fs_block_size);
+  cte->dirty = false;
 
   ASSERT(cache_table.size <= CACHE_TABLE_MAX_SIZE);
 
@@ -44,8 +76,12 @@ struct cache_table_entry *allocate_cache(disk_sector_t block) {
     // cache table size reached the limit
     struct cache_table_entry *victim = list_entry(list_pop_front(&cache_table.list), struct cache_table_entry, elem);
 
-    // WARNING: consider dirty bit
-    disk_write(filesys_disk, victim->block, victim->vaddr);
+    if (victim->dirty) {
+      // not before an older copy that cache_table_flush() is writing
+      lock_acquire(&cache_table.flush_io);
+      cache_block_write(victim);
+      lock_release(&cache_table.flush_io);
+    }
     free(victim->vaddr);
     free(victim);
     cache_table.size--;
@@ -58,15 +94,24 @@ struct cache_table_entry *allocate_cache(disk_sector_t block) {
 }
 
 void free_cache(disk_sector_t block) {
+  free_cache_range(block, 1);
+}
+
+/* Drops cached copies of the CNT blocks starting at sector BLOCK
+   without writing them back, in a single pass over the cache. */
+void free_cache_range(disk_sector_t block, size_t cnt) {
+  disk_sector_t end = block + cnt * fs_block_sectors;
+
   lock_acquire(&cache_table.lock);
-  struct list_elem *e;
-  for (e=list_begin(&cache_table.list); e!=list_end(&cache_table.list); e=list_next(e)) {
+  struct list_elem *e = list_begin(&cache_table.list);
+  while (e != list_end(&cache_table.list)) {
     struct cache_table_entry *cte = list_entry(e, struct cache_table_entry, elem);
-    if (cte->block == block) {
+    e = list_next(e);
+    if (cte->block >= block && cte->block < end) {
       list_remove(&cte->elem);
       free(cte->vaddr);
       free(cte);
-      break;
+      cache_table.size--;
     }
   }
   lock_release(&cache_table.lock);
@@ -82,7 +127,7 @@ void cache_table_read(uint8_t *buffer, disk_sector_t sector, int offset, int siz
   } else {
     // read from disk into buffer cache and copy it to destination buffer
     cte = allocate_cache(sector);
-    disk_read(filesys_disk, sector, cte->vaddr);
+    cache_block_read(cte);
     memcpy(buffer, cte->vaddr + offset, size);
   }
   lock_release(&cache_table.lock);
@@ -95,23 +140,85 @@ void cache_table_write(uint8_t *buffer, disk_sector_t sector, int offset, int si
   if (cte) {
     // write to buffer cache
     memcpy(cte->vaddr + offset, buffer, size);
+    cte->dirty = true;
   } else {
     // read from disk into buffer cache and copy it to buffer
+    // (whole block overwrites need not read the old contents)
     cte = allocate_cache(sector);
-    disk_read(filesys_disk, sector, cte->vaddr);
+    if (offset != 0 || size != (int) fs_block_size) {
+      cache_block_read(cte);
+    }
     memcpy(cte->vaddr + offset, buffer, size);
+    cte->dirty = true;
   }
   lock_release(&cache_table.lock);
 }
 
+/* Fills the cached copy of SECTOR with zeros without reading the
+   disk, used for the first write into a freshly reserved block. */
+void cache_table_zero(disk_sector_t sector) {
+
+  lock_acquire(&cache_table.lock);
+  struct cache_table_entry *cte = cache_table_find(sector);
+  if (!cte) {
+    cte = allocate_cache(sector);
+  }
+  memset(cte->vaddr, 0, fs_block_size);
+  cte->dirty = true;
+  lock_release(&cache_table.lock);
+}
+
+/* Writes the dirty blocks back to disk.  They are copied under
+   cache_table.lock and written from the copies once it is released,
+   so that the cache is not held up by the disk; flush_io is held
+   until the writes are done, for evictions to wait on. */
 void cache_table_flush(void) {
     lock_acquire(&cache_table.lock);
     struct list_elem *e;
+    size_t dirty = 0;
+
+    for (e=list_begin(&cache_table.list); e!=list_end(&cache_table.list); e=list_next(e)) {
+      if (list_entry(e, struct cache_table_entry, elem)->dirty) {
+        dirty++;
+      }
+    }
+    if (dirty == 0) {
+      lock_release(&cache_table.lock);
+      return;
+    }
+
+    // queue write-back of every dirty block, then wait for all of them
+    struct disk_request *reqs = malloc(dirty * fs_block_sectors * sizeof *reqs);
+    uint8_t *copies = malloc(dirty * fs_block_size);
+    struct semaphore done;
+    size_t cnt = 0, i;
+    sema_init(&done, 0);
+
+    lock_acquire(&cache_table.flush_io);
     for (e=list_begin(&cache_table.list); e!=list_end(&cache_table.list); e=list_next(e)) {
       struct cache_table_entry *cte = list_entry(e, struct cache_table_entry, elem);
-      disk_write(filesys_disk, cte->block, cte->vaddr);
+      if (!cte->dirty) {
+        continue;
+      }
+      cte->dirty = false;
+      if (reqs && copies) {
+        uint8_t *copy = copies + cnt * fs_block_size;
+        memcpy(copy, cte->vaddr, fs_block_size);
+        cache_block_submit(cte->block, copy, reqs + cnt * fs_block_sectors, true, &done);
+        cnt++;
+      } else {
+        // no memory for copies: write in place, with the lock held
+        cache_block_write(cte);
+      }
     }
     lock_release(&cache_table.lock);
+
+    for (i=0; i<cnt * fs_block_sectors; i++) {
+      sema_down(&done);
+    }
+    lock_release(&cache_table.flush_io);
+    free(reqs);
+    free(copies);
 }
 
 void cache_table_thread(void *aux UNUSED) {
@@ -12,8 +12,9 @@
 #define CACHE_TABLE_FLUSH_PERIOD 50 // millisecond
 
 struct cache_table_entry {
-  disk_sector_t block;
-  uint8_t *vaddr; // kernel virtual memory, shared address among all threads
+  disk_sector_t block; // first sector of the cached file system block
+  uint8_t *vaddr; // kernel virtual memory, shared address among all threads (fs_block_size bytes)
+  bool dirty; // written since last written back
   struct list_elem elem;
 };
 
@@ -21,15 +22,20 @@ struct cache_table {
   struct list list;
   int size;
   struct lock lock;
+  struct lock flush_io; // held by cache_table_flush() until its writes are done
   bool destroyed; // true: filesys_done called
 };
 
 void cache_table_init(void);
+void cache_block_read(struct cache_table_entry *cte);
+void cache_block_write(struct cache_table_entry *cte);
 struct cache_table_entry *cache_table_find(disk_sector_t sector);
 struct cache_table_entry *allocate_cache(disk_sector_t sector);
 void free_cache(disk_sector_t sector);
+void free_cache_range(disk_sector_t sector, size_t cnt);
 void cache_table_read(uint8_t *buffer, disk_sector_t sector, int offset, int size);
 void cache_table_write(uint8_t *buffer, disk_sector_t sector, int offset, int size);
+void cache_table_zero(disk_sector_t sector);
 void cache_table_flush(void);
 void cache_table_thread(void *aux UNUSED);
 void cache_table_destroy(void);
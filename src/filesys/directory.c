@@ -7,6 +7,10 @@
 #include "threads/malloc.h"
 #include "userprog/process.h"
 
+#ifdef PR_FS
+#include "filesys/tmpfs.h"
+#endif
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
@@ -129,7 +133,12 @@ dir_lookup (const struct dir *dir, const char *name,
   #endif
 
   if (lookup (dir, name, &e, NULL))
+    #ifdef PR_FS
+    // a directory with a tmpfs mounted on it is replaced by the tmpfs root
+    *inode = inode_open (tmpfs_follow_mount (e.inode_sector));
+    #else
     *inode = inode_open (e.inode_sector);
+    #endif
   else
     *inode = NULL;
 
@@ -236,6 +245,10 @@ dir_remove (struct dir *dir, const char *name)
     // reject removing root directory
     goto done;
   }
+  if (tmpfs_is_mountpoint(inode->sector)) {
+    // reject removing a mountpoint
+    goto done;
+  }
   if (inode->data.is_dir) {
     struct dir *temp = dir_open(inode_reopen(inode));
     if (!dir_empty(temp)) {
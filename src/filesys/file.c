@@ -104,6 +104,29 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+#ifdef PR_FS
+/* Reserves disk space for SIZE bytes of FILE starting at offset
+   FILE_OFS, extending the file if needed, without writing any
+   data.  The file's current position is unaffected.
+   Returns true if successful, false if the disk is full or
+   writes to FILE are denied. */
+bool
+file_allocate (struct file *file, off_t file_ofs, off_t size)
+{
+  return inode_fallocate (file->inode, file_ofs, size);
+}
+
+/* Sets the size of FILE to LENGTH bytes, releasing the blocks past
+   the new end or leaving a zero-filled hole when growing.
+   The file's current position is unaffected.
+   Returns true if successful, false if writes to FILE are denied. */
+bool
+file_truncate (struct file *file, off_t length)
+{
+  return inode_truncate (file->inode, length);
+}
+#endif
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
@@ -24,6 +24,10 @@ off_t file_read (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
+#ifdef PR_FS
+bool file_allocate (struct file *, off_t start, off_t size);
+bool file_truncate (struct file *, off_t length);
+#endif
 
 /* Preventing writes. */
 void file_deny_write (struct file *);
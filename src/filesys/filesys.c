@@ -10,6 +10,7 @@
 #ifdef PR_FS
 #include "userprog/process.h"
 #include "filesys/cache.h"
+#include "filesys/tmpfs.h"
 #include "threads/malloc.h"
 
 #define DEPTH_MAX 128
@@ -18,16 +19,36 @@
 /* The disk that contains the file system. */
 struct disk *filesys_disk;
 
-static void do_format (void);
+#ifdef PR_FS
+/* Size of a file system block (cluster), fixed at format time. */
+unsigned fs_block_sectors = 1;
+unsigned fs_block_size = DISK_SECTOR_SIZE;
+
+static void read_block_size (void);
+#endif
+
+static void do_format (size_t block_size);
 
 /* Initializes the file system module.
-   If FORMAT is true, reformats the file system. */
+   If FORMAT is true, reformats the file system with BLOCK_SIZE-byte
+   blocks; otherwise the block size recorded on disk is used. */
 void
-filesys_init (bool format)
+filesys_init (bool format, size_t block_size)
 {
-  filesys_disk = disk_get (0, 1);
+  filesys_disk = disk_get_role (DISK_FILESYS);
   if (filesys_disk == NULL)
-    PANIC ("hd0:1 (hdb) not present, file system initialization failed");
+    PANIC ("no file system disk (vd0 or hd0:1), file system initialization failed");
+
+  #ifdef PR_FS
+  if (format) {
+    ASSERT (block_size >= DISK_SECTOR_SIZE && block_size <= FS_BLOCK_SIZE_MAX);
+    ASSERT (block_size % DISK_SECTOR_SIZE == 0);
+    fs_block_sectors = block_size / DISK_SECTOR_SIZE;
+    fs_block_size = block_size;
+  } else {
+    read_block_size ();
+  }
+  #endif
 
   inode_init ();
   free_map_init ();
@@ -36,14 +57,15 @@ filesys_init (bool format)
   cache_table_init();
   // initialize unused array
   int i;
-  for (i=0; i<DISK_SECTOR_SIZE; i++) {
+  for (i=0; i<(int) (FS_BLOCK_SIZE_MAX / sizeof(disk_sector_t)); i++) {
       unused[i] = UNUSED_SECTOR;
   }
   lock_init(&inode_lock);
+  tmpfs_init();
   #endif
 
   if (format)
-    do_format ();
+    do_format (block_size);
 
   free_map_open ();
 }
@@ -135,11 +157,11 @@ bool filesys_find_and_create(struct dir *dir, struct inode *inode, const char *n
   // final creation
   disk_sector_t inode_sector = 0;
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
+                  && inode_allocate (dir->inode, &inode_sector)
                   && inode_create (inode_sector, initial_size, false, dir->inode->sector)
                   && dir_add (dir, final, inode_sector));
   if (!success && inode_sector != 0)
-    free_map_release (inode_sector, 1);
+    inode_release (inode_sector);
 
   dir_close (dir);
 
@@ -192,6 +214,46 @@ struct file *filesys_find_and_open(struct dir *dir, struct inode *inode, const c
    return true;
 }
 
+/* Mounts an empty tmpfs on the directory at absolute path NAME,
+   creating the directory if it does not exist.  Everything below
+   it then lives in memory and is lost at shutdown.
+   Returns true if successful, false otherwise. */
+bool filesys_mount_tmpfs(const char *name) {
+  char *path = malloc(strlen(name) + 1);
+  if (path == NULL) {
+    return false;
+  }
+  strlcpy(path, name, strlen(name) + 1);
+
+  char *final; // mountpoint name
+  struct dir *root = dir_open_root();
+  struct dir *dir = filesys_find_dir(root, root->inode, path, &final); // parent of mountpoint
+  dir_close(root);
+
+  bool success = false;
+  if (dir != NULL && *final != '\0' && strcmp(final, ".") && strcmp(final, "..")) {
+    struct inode *inode = NULL;
+    if (!dir_lookup(dir, final, &inode)) {
+      // create the mountpoint
+      disk_sector_t inode_sector = 0;
+      if (inode_allocate(dir->inode, &inode_sector)
+          && dir_create(inode_sector, 0, dir->inode->sector)
+          && dir_add(dir, final, inode_sector)) {
+        inode = inode_open(inode_sector);
+      } else if (inode_sector != 0) {
+        inode_release(inode_sector);
+      }
+    }
+    if (inode != NULL && inode->data.is_dir) {
+      success = tmpfs_mount(inode->sector, dir->inode->sector);
+    }
+    inode_close(inode);
+  }
+  dir_close(dir);
+  free(path);
+  return success;
+}
+
 
 #endif
 
@@ -296,11 +358,32 @@ filesys_remove (const char *name)
   #endif
 }
 
-/* Formats the file system. */
+#ifdef PR_FS
+/* Reads the block size the file system was formatted with from the
+   free map inode.  File systems formatted before block sizes were
+   recorded have a zero there and use one-sector blocks. */
+static void
+read_block_size (void)
+{
+  struct inode_disk *disk_inode = malloc (sizeof *disk_inode);
+  if (disk_inode == NULL)
+    PANIC ("can't read file system block size");
+
+  disk_read (filesys_disk, FREE_MAP_SECTOR, disk_inode);
+  fs_block_sectors = disk_inode->block_sectors != 0 ? disk_inode->block_sectors : 1;
+  fs_block_size = fs_block_sectors * DISK_SECTOR_SIZE;
+  free (disk_inode);
+
+  if (fs_block_size > FS_BLOCK_SIZE_MAX)
+    PANIC ("unsupported file system block size %u", fs_block_size);
+}
+#endif
+
+/* Formats the file system with BLOCK_SIZE-byte blocks. */
 static void
-do_format (void)
+do_format (size_t block_size)
 {
-  printf ("Formatting file system...");
+  printf ("Formatting file system with %zu-byte blocks...", block_size);
   free_map_create ();
   if (!dir_create (ROOT_DIR_SECTOR, 16, UNUSED_SECTOR))
     PANIC ("root directory creation failed");
@@ -2,6 +2,7 @@
 #define FILESYS_FILESYS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "filesys/off_t.h"
 #include <debug.h>
 
@@ -16,7 +17,7 @@
 /* Disk used for file system. */
 extern struct disk *filesys_disk;
 
-void filesys_init (bool format);
+void filesys_init (bool format, size_t block_size);
 void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size);
 struct file *filesys_open (const char *name);
@@ -28,5 +29,6 @@ struct dir *filesys_find_dir(struct dir *dir, struct inode *inode, const char *n
 bool filesys_find_and_create(struct dir *dir, struct inode *inode, const char *name, off_t iniitial_size);
 struct file *filesys_find_and_open(struct dir *dir, struct inode *inode, const char *name);
 bool filesys_find_and_remove(struct dir *dir, struct inode *inode, const char *name);
+bool filesys_mount_tmpfs(const char *name);
 #endif
 #endif /* filesys/filesys.h */
@@ -6,46 +6,67 @@
 #include "filesys/inode.h"
 
 static struct file *free_map_file;   /* Free map file. */
-static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
+static struct bitmap *free_map;      /* Free map, one bit per file
+                                        system block (cluster). */
 
-/* Initializes the free map. */
+/* Initializes the free map.  fs_block_sectors must already be set. */
 void
 free_map_init (void)
 {
-  free_map = bitmap_create (disk_size (filesys_disk));
+  free_map = bitmap_create (disk_size (filesys_disk) / fs_block_sectors);
   if (free_map == NULL)
     PANIC ("bitmap creation failed--disk is too large");
-  bitmap_mark (free_map, FREE_MAP_SECTOR);
-  bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_mark (free_map, FREE_MAP_SECTOR / fs_block_sectors);
+  bitmap_mark (free_map, ROOT_DIR_SECTOR / fs_block_sectors);
 }
 
-/* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
-   Returns true if successful, false if all sectors were
+/* Allocates CNT consecutive blocks from the free map and stores
+   the first sector of the first one into *SECTORP.
+   Returns true if successful, false if all blocks were
    available. */
 bool
 free_map_allocate (size_t cnt, disk_sector_t *sectorp)
 {
-  disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
+  size_t block = bitmap_scan_and_flip (free_map, 0, cnt, false);
+  if (block != BITMAP_ERROR
       && free_map_file != NULL
       && !bitmap_write (free_map, free_map_file))
     {
-      bitmap_set_multiple (free_map, sector, cnt, false);
-      sector = BITMAP_ERROR;
+      bitmap_set_multiple (free_map, block, cnt, false);
+      block = BITMAP_ERROR;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  if (block != BITMAP_ERROR)
+    *sectorp = block * fs_block_sectors;
+  return block != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Makes CNT blocks starting at SECTOR available for use. */
 void
 free_map_release (disk_sector_t sector, size_t cnt)
 {
-  ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  free_map_release_deferred (sector, cnt);
+  free_map_sync ();
+}
+
+/* Makes CNT blocks starting at SECTOR available for use without
+   writing the free map back to disk.  Callers releasing many
+   extents at once follow up with a single free_map_sync(). */
+void
+free_map_release_deferred (disk_sector_t sector, size_t cnt)
+{
+  size_t block = sector / fs_block_sectors;
+
+  ASSERT (sector % fs_block_sectors == 0);
+  ASSERT (bitmap_all (free_map, block, cnt));
+  bitmap_set_multiple (free_map, block, cnt, false);
+}
+
+/* Writes the in-memory free map back to its file. */
+void
+free_map_sync (void)
+{
+  if (free_map_file != NULL)
+    bitmap_write (free_map, free_map_file);
 }
 
 /* Opens the free map file and reads it from disk. */
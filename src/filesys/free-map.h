@@ -13,5 +13,7 @@ void free_map_close (void);
 
 bool free_map_allocate (size_t, disk_sector_t *);
 void free_map_release (disk_sector_t, size_t);
+void free_map_release_deferred (disk_sector_t, size_t);
+void free_map_sync (void);
 
 #endif /* filesys/free-map.h */
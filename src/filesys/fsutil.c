@@ -97,7 +97,7 @@ fsutil_put (char **argv)
     PANIC ("couldn't allocate buffer");
 
   /* Open source disk and read file size. */
-  src = disk_get (1, 0);
+  src = disk_get_role (DISK_SCRATCH);
   if (src == NULL)
     PANIC ("couldn't open source disk (hdc or hd1:0)");
 
@@ -168,7 +168,7 @@ fsutil_get (char **argv)
   size = file_length (src);
 
   /* Open target disk. */
-  dst = disk_get (1, 0);
+  dst = disk_get_role (DISK_SCRATCH);
   if (dst == NULL)
     PANIC ("couldn't open target disk (hdc or hd1:0)");
 
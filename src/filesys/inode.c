@@ -1,6 +1,7 @@
 #include "filesys/inode.h"
 #include <list.h>
 #include <round.h>
+#include <stdint.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
@@ -8,24 +9,29 @@
 
 #ifdef PR_FS
 #include "filesys/cache.h"
+#include "filesys/tmpfs.h"
 #endif
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
-/* Returns the number of sectors to allocate for an inode SIZE
+/* Returns the number of blocks to allocate for an inode SIZE
    bytes long. */
 static inline size_t
-bytes_to_sectors (off_t size)
+bytes_to_blocks (off_t size)
 {
-  return DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
+  return DIV_ROUND_UP (size, fs_block_size);
 }
 
 
 #ifdef PR_FS
-disk_sector_t unused[DISK_SECTOR_SIZE]; // initialized to UNUSED_SECTOR
+disk_sector_t unused[FS_BLOCK_SIZE_MAX / sizeof(disk_sector_t)]; // initialized to UNUSED_SECTOR
 struct lock inode_lock;
+static disk_sector_t lookup_block(const struct inode_disk *data, unsigned pos);
+static bool set_block(struct inode_disk *data, unsigned pos, disk_sector_t block);
 static disk_sector_t allocate_block(struct inode_disk *data, unsigned pos);
+static bool reserve_blocks(struct inode_disk *data, unsigned start, size_t cnt);
+static void truncate_blocks(struct inode_disk *data, unsigned keep);
 static void free_blocks(struct inode_disk *data);
 #endif
 
@@ -52,129 +58,312 @@ static struct list open_inodes;
 
 #ifdef PR_FS
 
-disk_sector_t allocate_block(struct inode_disk *data, unsigned pos) {
+/* Returns the block pointer stored for logical block POS of DATA,
+   or UNUSED_SECTOR if that block has never been allocated.
+   Never allocates anything. */
+disk_sector_t lookup_block(const struct inode_disk *data, unsigned pos) {
   disk_sector_t indirect;
   disk_sector_t block;
 
-  static char zeros[DISK_SECTOR_SIZE];
-
-  // printf("[allocate block] pos: %u\n", pos);
   if (pos < DIRECT_MAX) {
     // direct block
-    if (data->direct[pos] == UNUSED_SECTOR) {
-      if (!free_map_allocate(1, &data->direct[pos])) {
-        return UNUSED_SECTOR;
-      }
-      cache_table_write(zeros, data->direct[pos], 0, DISK_SECTOR_SIZE);
+    return data->direct[pos];
+  } else if (pos < DIRECT_MAX + PTRS_PER_BLOCK) {
+    // indirect block
+    if (data->indirect == UNUSED_SECTOR) {
+      return UNUSED_SECTOR;
+    }
+
+    int doffset = pos - DIRECT_MAX;
+
+    cache_table_read((uint8_t *)&block, data->indirect, doffset * sizeof(disk_sector_t), sizeof(disk_sector_t));
+  } else if (pos < BLOCK_MAX) {
+    // double indirect block
+    if (data->double_indirect == UNUSED_SECTOR) {
+      return UNUSED_SECTOR;
     }
-    block = data->direct[pos];
-  } else if (pos < DIRECT_MAX + SECTOR_MAX) {
+
+    int ioffset = (pos - DIRECT_MAX - PTRS_PER_BLOCK) / PTRS_PER_BLOCK;
+    int doffset = (pos - DIRECT_MAX - PTRS_PER_BLOCK) % PTRS_PER_BLOCK;
+
+    cache_table_read((uint8_t *)&indirect, data->double_indirect, ioffset * sizeof(disk_sector_t), sizeof(disk_sector_t));
+    if (indirect == UNUSED_SECTOR) {
+      return UNUSED_SECTOR;
+    }
+    cache_table_read((uint8_t *)&block, indirect, doffset * sizeof(disk_sector_t), sizeof(disk_sector_t));
+  } else {
+    return UNUSED_SECTOR;
+  }
+  return block;
+}
+
+/* Stores BLOCK as the pointer for logical block POS of DATA,
+   allocating index blocks on the way.
+   Returns false if POS is out of range or the disk is full. */
+bool set_block(struct inode_disk *data, unsigned pos, disk_sector_t block) {
+  disk_sector_t indirect;
+
+  if (pos < DIRECT_MAX) {
+    // direct block
+    data->direct[pos] = block;
+  } else if (pos < DIRECT_MAX + PTRS_PER_BLOCK) {
     // indirect block
     if (data->indirect == UNUSED_SECTOR) {
       // indirect block does not exist
       if(!free_map_allocate(1, &data->indirect)) {
-        return UNUSED_SECTOR;
+        return false;
       }
-      cache_table_write((uint8_t *)unused, data->indirect, 0, DISK_SECTOR_SIZE);
+      cache_table_write((uint8_t *)unused, data->indirect, 0, fs_block_size);
     }
 
     int doffset = pos - DIRECT_MAX;
 
-    cache_table_read((uint8_t *)&block, data->indirect, doffset * sizeof(disk_sector_t), sizeof(disk_sector_t));
-    if (block == UNUSED_SECTOR) {
-      if (!free_map_allocate(1, &block)) {
-        return UNUSED_SECTOR;
-      }
-      cache_table_write((uint8_t *)&block, data->indirect, doffset * sizeof(disk_sector_t), sizeof(disk_sector_t));
-      cache_table_write(zeros, block, 0, DISK_SECTOR_SIZE);
-    }
-  } else {
+    cache_table_write((uint8_t *)&block, data->indirect, doffset * sizeof(disk_sector_t), sizeof(disk_sector_t));
+  } else if (pos < BLOCK_MAX) {
     // double indirect block
     if (data->double_indirect == UNUSED_SECTOR) {
       // double indirect block does not exist
       if (!free_map_allocate(1, &data->double_indirect)) {
-        return UNUSED_SECTOR;
+        return false;
       }
-      cache_table_write((uint8_t *)unused, data->double_indirect, 0, DISK_SECTOR_SIZE);
+      cache_table_write((uint8_t *)unused, data->double_indirect, 0, fs_block_size);
     }
 
-    int ioffset = (pos - DIRECT_MAX - SECTOR_MAX) / SECTOR_MAX;
-    int doffset = (pos - DIRECT_MAX - SECTOR_MAX) % SECTOR_MAX;
+    int ioffset = (pos - DIRECT_MAX - PTRS_PER_BLOCK) / PTRS_PER_BLOCK;
+    int doffset = (pos - DIRECT_MAX - PTRS_PER_BLOCK) % PTRS_PER_BLOCK;
 
     cache_table_read((uint8_t *)&indirect, data->double_indirect, ioffset * sizeof(disk_sector_t), sizeof(disk_sector_t));
     if (indirect == UNUSED_SECTOR) {
       if (!free_map_allocate(1, &indirect)) {
-        return UNUSED_SECTOR;
+        return false;
       }
       cache_table_write((uint8_t *)&indirect, data->double_indirect, ioffset * sizeof(disk_sector_t), sizeof(disk_sector_t));
-      cache_table_write((uint8_t *)unused, indirect, 0, DISK_SECTOR_SIZE);
+      cache_table_write((uint8_t *)unused, indirect, 0, fs_block_size);
     }
 
-    cache_table_read((uint8_t *)&block, indirect, doffset * sizeof(disk_sector_t), sizeof(disk_sector_t));
-    if (block == UNUSED_SECTOR) {
-      if (!free_map_allocate(1, &block)) {
-        return UNUSED_SECTOR;
-      }
-      cache_table_write((uint8_t *)&block, indirect, doffset * sizeof(disk_sector_t), sizeof(disk_sector_t));
-      cache_table_write(zeros, block, 0, DISK_SECTOR_SIZE);
+    cache_table_write((uint8_t *)&block, indirect, doffset * sizeof(disk_sector_t), sizeof(disk_sector_t));
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/* Returns the block pointer for logical block POS of DATA,
+   allocating a new unwritten block if POS is a hole.
+   Returns UNUSED_SECTOR if the disk is full. */
+disk_sector_t allocate_block(struct inode_disk *data, unsigned pos) {
+  disk_sector_t block = lookup_block(data, pos);
+
+  if (block == UNUSED_SECTOR) {
+    if (!free_map_allocate(1, &block)) {
+      return UNUSED_SECTOR;
     }
+    if (!set_block(data, pos, block | UNWRITTEN_BIT)) {
+      free_map_release(block, 1);
+      return UNUSED_SECTOR;
+    }
+    block |= UNWRITTEN_BIT;
   }
   return block;
 }
 
-void free_blocks(struct inode_disk *data) {
-  // how to free blocks?
-  // blocks from 1 ~ length divided by DISK_SECTOR_SIZE
-  // don't know which one is actually in use so just iterate through all and free
+/* Reserves every hole among logical blocks [START, START + CNT) of
+   DATA as unwritten blocks.  Each hole is filled with the longest
+   contiguous runs the free map can hand out, and nothing is
+   zero-filled on disk: unwritten blocks read back as zeros until
+   they are first written.
+   Returns false if the disk fills up. */
+bool reserve_blocks(struct inode_disk *data, unsigned start, size_t cnt) {
+  unsigned pos = start;
+  unsigned end = start + cnt;
 
-  int pos;
-  int sectors = bytes_to_sectors(data->length);
+  if (end > BLOCK_MAX) {
+    return false;
+  }
 
-  disk_sector_t indirect;
-  disk_sector_t block;
+  while (pos < end) {
+    if (lookup_block(data, pos) != UNUSED_SECTOR) {
+      pos++;
+      continue;
+    }
 
-  for (pos=sectors-1; pos>=0; pos--) {
-    if (pos < DIRECT_MAX) {
-      // free direct block
-      free_map_release(data->direct[pos], 1);
-      free_cache(data->direct[pos]);
-    } else if (pos < DIRECT_MAX + SECTOR_MAX) {
-      // free indirect block
-      int doffset = pos - DIRECT_MAX;
+    // length of the hole starting at pos
+    size_t run = 1;
+    while (pos + run < end && lookup_block(data, pos + run) == UNUSED_SECTOR) {
+      run++;
+    }
 
-      cache_table_read((uint8_t *)&block, data->indirect, doffset * sizeof(disk_sector_t), sizeof(disk_sector_t));
-      if (block != UNUSED_SECTOR) {
-        free_map_release(block, 1);
-        free_cache(block);
+    // take the largest contiguous extent that fits in the free map
+    disk_sector_t first;
+    size_t n = run;
+    while (!free_map_allocate(n, &first)) {
+      if (n == 1) {
+        return false;
       }
-      if (doffset == 0) {
-        free_map_release(data->indirect, 1);
-        free_cache(data->indirect);
+      n /= 2;
+    }
+
+    size_t i;
+    for (i=0; i<n; i++) {
+      disk_sector_t block = first + i * fs_block_sectors;
+      if (!set_block(data, pos + i, block | UNWRITTEN_BIT)) {
+        free_map_release(block, n - i);
+        return false;
       }
-    } else {
-      // free double indirect block
-      int ioffset = (pos - DIRECT_MAX - SECTOR_MAX) / SECTOR_MAX;
-      int doffset = (pos - DIRECT_MAX - SECTOR_MAX) % SECTOR_MAX;
+    }
+    pos += n;
+  }
+  return true;
+}
 
-      cache_table_read((uint8_t *)&indirect, data->double_indirect, ioffset * sizeof(disk_sector_t), sizeof(disk_sector_t));
-      if (indirect != UNUSED_SECTOR) {
-        cache_table_read((uint8_t *)&block, indirect, doffset * sizeof(disk_sector_t), sizeof(disk_sector_t));
-        if (block != UNUSED_SECTOR) {
-          free_map_release(block, 1);
-          free_cache(block);
-        }
-        if (doffset == 0) {
-          free_map_release(indirect, 1);
-          free_cache(indirect);
-        }
-      }
+/* Run of contiguous blocks waiting to be released, so that a
+   whole extent costs one free map update instead of one per block. */
+struct free_run {
+  disk_sector_t start; // first sector of the run
+  size_t cnt; // number of blocks
+};
 
-      if (ioffset == 0 && doffset == 0) {
-        free_map_release(data->double_indirect, 1);
-        free_cache(data->double_indirect);
+/* Releases the blocks accumulated in RUN. */
+static void free_run_flush(struct free_run *run) {
+  if (run->cnt > 0) {
+    free_map_release_deferred(run->start, run->cnt);
+    free_cache_range(run->start, run->cnt);
+    run->cnt = 0;
+  }
+}
+
+/* Adds block pointer BLOCK to RUN, flushing RUN first if BLOCK does
+   not extend it. */
+static void free_run_add(struct free_run *run, disk_sector_t block) {
+  disk_sector_t sector = BLOCK_SECTOR(block);
+
+  if (run->cnt > 0 && run->start + run->cnt * fs_block_sectors == sector) {
+    run->cnt++;
+    return;
+  }
+  free_run_flush(run);
+  run->start = sector;
+  run->cnt = 1;
+}
+
+/* Releases the pointers in index block entries [FIRST, PTRS_PER_BLOCK)
+   of TABLE into RUN and marks them unused.
+   Returns true if any entry changed. */
+static bool free_index_entries(disk_sector_t *table, unsigned first, struct free_run *run) {
+  bool changed = false;
+  unsigned i;
+
+  for (i=first; i<PTRS_PER_BLOCK; i++) {
+    if (table[i] != UNUSED_SECTOR) {
+      free_run_add(run, table[i]);
+      table[i] = UNUSED_SECTOR;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+/* Frees every block of DATA at logical position KEEP or beyond,
+   together with the index blocks that end up empty.
+   Each index block is read once and written back at most once;
+   released blocks are gathered into runs and the free map is
+   written back a single time by the caller via free_map_sync(). */
+void truncate_blocks(struct inode_disk *data, unsigned keep) {
+  struct free_run run = { 0, 0 };
+  disk_sector_t *table = malloc(fs_block_size);
+  disk_sector_t *dtable = malloc(fs_block_size);
+  unsigned pos;
+
+  ASSERT(table != NULL && dtable != NULL);
+
+  // direct blocks
+  for (pos=keep; pos<DIRECT_MAX; pos++) {
+    if (data->direct[pos] != UNUSED_SECTOR) {
+      free_run_add(&run, data->direct[pos]);
+      data->direct[pos] = UNUSED_SECTOR;
+    }
+  }
+
+  // indirect block
+  if (data->indirect != UNUSED_SECTOR) {
+    unsigned first = keep > DIRECT_MAX ? keep - DIRECT_MAX : 0;
+    if (first < PTRS_PER_BLOCK) {
+      cache_table_read((uint8_t *)table, data->indirect, 0, fs_block_size);
+      bool changed = free_index_entries(table, first, &run);
+      if (first == 0) {
+        free_run_add(&run, data->indirect);
+        data->indirect = UNUSED_SECTOR;
+      } else if (changed) {
+        cache_table_write((uint8_t *)table, data->indirect, 0, fs_block_size);
       }
     }
   }
+
+  // double indirect block
+  if (data->double_indirect != UNUSED_SECTOR) {
+    unsigned first = keep > DIRECT_MAX + PTRS_PER_BLOCK ? keep - DIRECT_MAX - PTRS_PER_BLOCK : 0;
+    unsigned ioffset;
+    bool dchanged = false;
+
+    cache_table_read((uint8_t *)dtable, data->double_indirect, 0, fs_block_size);
+    for (ioffset=first / PTRS_PER_BLOCK; ioffset<PTRS_PER_BLOCK; ioffset++) {
+      if (dtable[ioffset] == UNUSED_SECTOR) {
+        continue;
+      }
+
+      unsigned doffset = ioffset == first / PTRS_PER_BLOCK ? first % PTRS_PER_BLOCK : 0;
+      cache_table_read((uint8_t *)table, dtable[ioffset], 0, fs_block_size);
+      bool changed = free_index_entries(table, doffset, &run);
+      if (doffset == 0) {
+        free_run_add(&run, dtable[ioffset]);
+        dtable[ioffset] = UNUSED_SECTOR;
+        dchanged = true;
+      } else if (changed) {
+        cache_table_write((uint8_t *)table, dtable[ioffset], 0, fs_block_size);
+      }
+    }
+
+    if (first == 0) {
+      free_run_add(&run, data->double_indirect);
+      data->double_indirect = UNUSED_SECTOR;
+    } else if (dchanged) {
+      cache_table_write((uint8_t *)dtable, data->double_indirect, 0, fs_block_size);
+    }
+  }
+
+  free_run_flush(&run);
+  free(table);
+  free(dtable);
+}
+
+/* Frees every block of DATA with a single free map update. */
+void free_blocks(struct inode_disk *data) {
+  truncate_blocks(data, 0);
+  free_map_sync();
+}
+#endif
+
+#ifdef PR_FS
+/* Reserves an inode number for a new file in directory PARENT:
+   a tmpfs inode if PARENT is on a tmpfs, otherwise a free disk
+   sector.  Returns false if none is left. */
+bool
+inode_allocate (const struct inode *parent, disk_sector_t *sectorp)
+{
+  if (is_tmpfs_sector(parent->sector))
+    return tmpfs_allocate(sectorp);
+  return free_map_allocate(1, sectorp);
+}
+
+/* Returns the inode number SECTOR, reserved with inode_allocate()
+   but never used, to where it came from. */
+void
+inode_release (disk_sector_t sector)
+{
+  if (is_tmpfs_sector(sector))
+    tmpfs_release(sector);
+  else
+    free_map_release(sector, 1);
 }
 #endif
 
@@ -205,12 +394,21 @@ inode_create (disk_sector_t sector, off_t length, bool is_dir, disk_sector_t par
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == DISK_SECTOR_SIZE);
 
+  #ifdef PR_FS
+  if (is_tmpfs_sector(sector)) {
+    return tmpfs_create(sector, length, is_dir, parent_dir);
+  }
+  #endif
+
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
+      size_t sectors = bytes_to_blocks (length);
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
+      #ifdef PR_FS
+      disk_inode->block_sectors = fs_block_sectors;
+      #endif
 
       #ifdef PR_FS
       // put in direct, indirect, double indirect blocks into inode_disk
@@ -226,19 +424,15 @@ inode_create (disk_sector_t sector, off_t length, bool is_dir, disk_sector_t par
       disk_inode->is_dir = is_dir;
       disk_inode->parent_dir = parent_dir;
 
-      success = true;
-      for (i=0; i<sectors; i++) {
-        if (allocate_block(disk_inode, i) == UNUSED_SECTOR) {
-          success = false;
-        }
-      }
+      // reserve contiguous unwritten blocks, no zero-fill needed
+      success = reserve_blocks(disk_inode, 0, sectors);
       #ifdef DEBUG
       printf("[inode_create MEANWHILE] success: %u, sectors: %d\n", success, sectors);
       #endif
       if (success) {
         disk_write(filesys_disk, sector, disk_inode);
       } else {
-        // WARNING: need to free allocated blocks when failed
+        free_blocks(disk_inode);
       }
       #else
       if (free_map_allocate (sectors, &disk_inode->start))
@@ -293,6 +487,12 @@ inode_open (disk_sector_t sector)
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
+  #ifdef PR_FS
+  if (is_tmpfs_sector(sector)) {
+    tmpfs_load(sector, &inode->data);
+    return inode;
+  }
+  #endif
   disk_read (filesys_disk, inode->sector, &inode->data);
   return inode;
 }
@@ -329,6 +529,18 @@ inode_close (struct inode *inode)
       /* Remove from inode list and release lock. */
       list_remove (&inode->elem);
 
+      #ifdef PR_FS
+      if (is_tmpfs_sector(inode->sector)) {
+        if (inode->removed) {
+          tmpfs_release(inode->sector);
+        } else {
+          tmpfs_store(inode->sector, &inode->data);
+        }
+        free (inode);
+        return;
+      }
+      #endif
+
       /* Deallocate blocks if removed. */
       if (inode->removed)
         {
@@ -337,7 +549,7 @@ inode_close (struct inode *inode)
           free_blocks(&inode->data);
           #else
           free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length));
+                            bytes_to_blocks (inode->data.length));
           #endif
         } else {
           // write back
@@ -371,15 +583,23 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   off_t bytes_read = 0;
   uint8_t *bounce = NULL;
 
+  #ifdef PR_FS
+  if (is_tmpfs_sector(inode->sector)) {
+    return tmpfs_read_at(inode->sector, buffer, size, offset, inode_length(inode));
+  }
+  #endif
+
   while (size > 0)
     {
       /* Disk sector to read, starting byte offset within sector. */
-      disk_sector_t sector_idx = allocate_block(&inode->data, offset / DISK_SECTOR_SIZE);
-      int sector_ofs = offset % DISK_SECTOR_SIZE;
+      #ifndef PR_FS
+      disk_sector_t sector_idx = byte_to_sector (inode, offset);
+      #endif
+      int sector_ofs = offset % fs_block_size;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
+      /* Bytes left in inode, bytes left in block, lesser of the two. */
       off_t inode_left = inode_length (inode) - offset;
-      int sector_left = DISK_SECTOR_SIZE - sector_ofs;
+      int sector_left = fs_block_size - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
       /* Number of bytes to actually copy out of this sector. */
@@ -388,7 +608,13 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
         break;
 
       #ifdef PR_FS
-      cache_table_read(buffer + bytes_read, sector_idx, sector_ofs, chunk_size);
+      disk_sector_t block = lookup_block(&inode->data, offset / fs_block_size);
+      if (block == UNUSED_SECTOR || IS_UNWRITTEN(block)) {
+        // holes and reserved blocks read as zeros without any I/O
+        memset(buffer + bytes_read, 0, chunk_size);
+      } else {
+        cache_table_read(buffer + bytes_read, block, sector_ofs, chunk_size);
+      }
       #else
       if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE)
         {
@@ -440,19 +666,48 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   if (inode->deny_write_cnt)
     return 0;
 
-  if (inode->data.length < offset + size) {
-      inode->data.length = offset + size;
+  #ifdef PR_FS
+  if (is_tmpfs_sector(inode->sector)) {
+    bytes_written = tmpfs_write_at(inode->sector, buffer, size, offset);
+    if (bytes_written > 0 && inode->data.length < offset + bytes_written) {
+      inode->data.length = offset + bytes_written;
+    }
+    return bytes_written;
   }
 
+  // reserve the blocks past the end of the file at once so that growth
+  // is contiguous; overwrites need no reservation.  If the disk fills,
+  // allocate_block() below takes whatever blocks are left one at a
+  // time, and the write comes up short where it fails too, so the
+  // result of reserve_blocks() is not needed.
+  if (size > 0) {
+    unsigned first = bytes_to_blocks(inode->data.length);
+    unsigned end = bytes_to_blocks(offset + size);
+    if (first < offset / fs_block_size) {
+      first = offset / fs_block_size;
+    }
+    if (first < end) {
+      reserve_blocks(&inode->data, first, end - first);
+    }
+  }
+  #endif
+
   while (size > 0)
     {
       /* Sector to write, starting byte offset within sector. */
-      disk_sector_t sector_idx = allocate_block(&inode->data, offset / DISK_SECTOR_SIZE);
-      int sector_ofs = offset % DISK_SECTOR_SIZE;
+      #ifdef PR_FS
+      disk_sector_t block = allocate_block(&inode->data, offset / fs_block_size);
+      if (block == UNUSED_SECTOR)
+        break;
+      disk_sector_t sector_idx = BLOCK_SECTOR(block);
+      #else
+      disk_sector_t sector_idx = byte_to_sector (inode, offset);
+      #endif
+      int sector_ofs = offset % fs_block_size;
 
       #ifdef PR_FS
       // file growth
-      int sector_left = DISK_SECTOR_SIZE - sector_ofs;
+      int sector_left = fs_block_size - sector_ofs;
       int chunk_size = size < sector_left ? size : sector_left;
       if (chunk_size <= 0)
         break;
@@ -469,6 +724,13 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       #endif
 
       #ifdef PR_FS
+      if (IS_UNWRITTEN(block)) {
+        // first write into a reserved block: start from zeros, not from disk
+        if (chunk_size < (int) fs_block_size) {
+          cache_table_zero(sector_idx);
+        }
+        set_block(&inode->data, offset / fs_block_size, sector_idx);
+      }
       cache_table_write((uint8_t *)buffer + bytes_written, sector_idx, sector_ofs, chunk_size);
       #else
       if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE)
@@ -505,9 +767,75 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
     }
   free (bounce);
 
+  #ifdef PR_FS
+  if (inode->data.length < offset) {
+      inode->data.length = offset;
+  }
+  #endif
+
   return bytes_written;
 }
 
+#ifdef PR_FS
+/* Reserves disk blocks for bytes [OFFSET, OFFSET + SIZE) of INODE
+   without writing them, growing INODE if the range ends past its
+   current length.  The reserved blocks read as zeros until they
+   are written.
+   Returns false if writes to INODE are denied or the disk fills
+   up. */
+bool
+inode_fallocate (struct inode *inode, off_t offset, off_t size)
+{
+  if (inode->deny_write_cnt || offset < 0 || size <= 0 || size > INT32_MAX - offset)
+    return false;
+
+  if (is_tmpfs_sector(inode->sector)) {
+    if (!tmpfs_fallocate(inode->sector, offset, size))
+      return false;
+  } else {
+    unsigned first = offset / fs_block_size;
+    if (!reserve_blocks(&inode->data, first, bytes_to_blocks(offset + size) - first))
+      return false;
+  }
+
+  if (inode->data.length < offset + size) {
+    inode->data.length = offset + size;
+  }
+  return true;
+}
+
+/* Sets the length of INODE to LENGTH bytes.  Blocks past the new
+   end are released in one batched pass; growing leaves a hole that
+   reads as zeros.
+   Returns false if writes to INODE are denied. */
+bool
+inode_truncate (struct inode *inode, off_t length)
+{
+  static char zeros[FS_BLOCK_SIZE_MAX];
+
+  if (inode->deny_write_cnt || length < 0)
+    return false;
+
+  if (is_tmpfs_sector(inode->sector)) {
+    tmpfs_truncate(inode->sector, inode->data.length, length);
+  } else if (length < inode->data.length) {
+    truncate_blocks(&inode->data, bytes_to_blocks(length));
+    free_map_sync();
+
+    // clear the tail of the last kept block so later growth reads zeros
+    int tail = length % fs_block_size;
+    if (tail != 0) {
+      disk_sector_t block = lookup_block(&inode->data, length / fs_block_size);
+      if (block != UNUSED_SECTOR && !IS_UNWRITTEN(block)) {
+        cache_table_write((uint8_t *)zeros, block, tail, fs_block_size - tail);
+      }
+    }
+  }
+  inode->data.length = length;
+  return true;
+}
+#endif
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
@@ -10,10 +10,20 @@
 #ifdef PR_FS
 #define UNUSED_SECTOR (disk_sector_t)-1
 
+#define FS_BLOCK_SIZE_MAX 4096 // largest block (cluster) size accepted at format time
+extern unsigned fs_block_sectors; // sectors per file system block
+extern unsigned fs_block_size; // bytes per file system block
+
 #define DIRECT_MAX 12 // maximum number of direct blocks in inode structure
-#define SECTOR_MAX 128 // maximum number of sectors in one disk sector
+#define PTRS_PER_BLOCK (fs_block_size / sizeof(disk_sector_t)) // number of block pointers in one index block
+#define BLOCK_MAX (DIRECT_MAX + PTRS_PER_BLOCK + PTRS_PER_BLOCK * PTRS_PER_BLOCK) // maximum number of blocks in one file
+
+// reserved (fallocated) block that was never written, reads as zeros
+#define UNWRITTEN_BIT 0x80000000
+#define IS_UNWRITTEN(BLOCK) ((BLOCK) != UNUSED_SECTOR && ((BLOCK) & UNWRITTEN_BIT))
+#define BLOCK_SECTOR(BLOCK) ((BLOCK) & ~UNWRITTEN_BIT)
 
-extern disk_sector_t unused[DISK_SECTOR_SIZE];
+extern disk_sector_t unused[FS_BLOCK_SIZE_MAX / sizeof(disk_sector_t)];
 extern struct lock inode_lock;
 #endif
 
@@ -29,12 +39,13 @@ struct inode_disk
     disk_sector_t double_indirect;
     int is_dir; // is inode directory?
     disk_sector_t parent_dir; // parent directory
+    uint32_t block_sectors; // sectors per block of the file system at format time
     #endif
     // disk_sector_t start;                /* First data sector. */
     off_t length;                       /* File size in bytes. */
 
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[110];               /* Not used. */
+    uint32_t unused[109];               /* Not used. */
   };
 
 /* In-memory inode. */
@@ -60,5 +71,11 @@ off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+#ifdef PR_FS
+bool inode_allocate (const struct inode *parent, disk_sector_t *);
+void inode_release (disk_sector_t);
+bool inode_fallocate (struct inode *, off_t offset, off_t size);
+bool inode_truncate (struct inode *, off_t length);
+#endif
 
 #endif /* filesys/inode.h */
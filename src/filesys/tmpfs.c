@@ -0,0 +1,285 @@
+#include "filesys/tmpfs.h"
+#include <string.h>
+#include <debug.h>
+#include <round.h>
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+// in-memory file or directory; data is kept in kernel pages allocated
+// on first write, so holes cost nothing and nothing goes through the buffer cache
+struct tmpfs_node {
+  bool in_use;
+  bool is_dir;
+  disk_sector_t parent_dir;
+  off_t length;
+  uint8_t **pages; // page_cnt entries, NULL for holes
+  size_t page_cnt;
+};
+
+// a directory on disk whose lookups are redirected to a tmpfs root
+struct tmpfs_mount {
+  disk_sector_t mountpoint;
+  disk_sector_t root;
+};
+
+static struct tmpfs_node nodes[TMPFS_INODE_MAX];
+static struct tmpfs_mount mounts[TMPFS_MOUNT_MAX];
+static int mount_cnt;
+
+// protects nodes and their pages
+static struct lock tmpfs_lock;
+
+static struct tmpfs_node *node_of(disk_sector_t sector) {
+  ASSERT(is_tmpfs_sector(sector));
+  return &nodes[sector - TMPFS_SECTOR_BASE];
+}
+
+void tmpfs_init(void) {
+  lock_init(&tmpfs_lock);
+  mount_cnt = 0;
+}
+
+/* Mounts a new, empty tmpfs on the directory in sector MOUNTPOINT,
+   whose parent is in sector PARENT_DIR. */
+bool tmpfs_mount(disk_sector_t mountpoint, disk_sector_t parent_dir) {
+  disk_sector_t root;
+
+  int i;
+
+  if (mount_cnt == TMPFS_MOUNT_MAX || tmpfs_is_mountpoint(mountpoint)) {
+    return false;
+  }
+  for (i=0; i<mount_cnt; i++) {
+    if (mounts[i].root == mountpoint) {
+      // already the root of a tmpfs
+      return false;
+    }
+  }
+  if (!tmpfs_allocate(&root)) {
+    return false;
+  }
+  if (!tmpfs_create(root, 0, true, parent_dir)) {
+    tmpfs_release(root);
+    return false;
+  }
+  mounts[mount_cnt].mountpoint = mountpoint;
+  mounts[mount_cnt].root = root;
+  mount_cnt++;
+  return true;
+}
+
+/* Returns the root of the tmpfs mounted on SECTOR, or SECTOR itself
+   if nothing is mounted there. */
+disk_sector_t tmpfs_follow_mount(disk_sector_t sector) {
+  int i;
+  for (i=0; i<mount_cnt; i++) {
+    if (mounts[i].mountpoint == sector) {
+      return mounts[i].root;
+    }
+  }
+  return sector;
+}
+
+bool tmpfs_is_mountpoint(disk_sector_t sector) {
+  return tmpfs_follow_mount(sector) != sector;
+}
+
+/* Reserves an unused tmpfs inode number. */
+bool tmpfs_allocate(disk_sector_t *sectorp) {
+  bool success = false;
+  int i;
+
+  lock_acquire(&tmpfs_lock);
+  for (i=0; i<TMPFS_INODE_MAX; i++) {
+    if (!nodes[i].in_use) {
+      memset(&nodes[i], 0, sizeof nodes[i]);
+      nodes[i].in_use = true;
+      *sectorp = TMPFS_SECTOR_BASE + i;
+      success = true;
+      break;
+    }
+  }
+  lock_release(&tmpfs_lock);
+  return success;
+}
+
+/* Initializes the tmpfs inode SECTOR, reserved with tmpfs_allocate(),
+   as a file of LENGTH bytes of zeros. */
+bool tmpfs_create(disk_sector_t sector, off_t length, bool is_dir, disk_sector_t parent_dir) {
+  struct tmpfs_node *node = node_of(sector);
+
+  ASSERT(node->in_use);
+  node->is_dir = is_dir;
+  node->parent_dir = parent_dir;
+  node->length = length;
+  return true;
+}
+
+/* Fills in DATA for opening the tmpfs inode SECTOR, in place of
+   reading an on-disk inode. */
+void tmpfs_load(disk_sector_t sector, struct inode_disk *data) {
+  struct tmpfs_node *node = node_of(sector);
+  int i;
+
+  memset(data, 0, sizeof *data);
+  for (i=0; i<DIRECT_MAX; i++) {
+    data->direct[i] = UNUSED_SECTOR;
+  }
+  data->indirect = UNUSED_SECTOR;
+  data->double_indirect = UNUSED_SECTOR;
+  data->is_dir = node->is_dir;
+  data->parent_dir = node->parent_dir;
+  data->length = node->length;
+}
+
+/* Saves DATA back when the tmpfs inode SECTOR is closed. */
+void tmpfs_store(disk_sector_t sector, const struct inode_disk *data) {
+  node_of(sector)->length = data->length;
+}
+
+// frees pages [FIRST, page_cnt) of NODE
+static void free_pages_from(struct tmpfs_node *node, size_t first) {
+  size_t i;
+  for (i=first; i<node->page_cnt; i++) {
+    if (node->pages[i]) {
+      palloc_free_page(node->pages[i]);
+      node->pages[i] = NULL;
+    }
+  }
+}
+
+/* Frees the tmpfs inode SECTOR and all of its data. */
+void tmpfs_release(disk_sector_t sector) {
+  struct tmpfs_node *node = node_of(sector);
+
+  lock_acquire(&tmpfs_lock);
+  free_pages_from(node, 0);
+  free(node->pages);
+  memset(node, 0, sizeof *node);
+  lock_release(&tmpfs_lock);
+}
+
+// returns page IDX of NODE, allocating it (and growing the page array) if CREATE
+static uint8_t *get_page(struct tmpfs_node *node, size_t idx, bool create) {
+  if (idx >= node->page_cnt) {
+    if (!create) {
+      return NULL;
+    }
+    size_t cnt = node->page_cnt ? node->page_cnt : 4;
+    while (cnt <= idx) {
+      cnt *= 2;
+    }
+    uint8_t **pages = realloc(node->pages, cnt * sizeof *pages);
+    if (!pages) {
+      return NULL;
+    }
+    memset(pages + node->page_cnt, 0, (cnt - node->page_cnt) * sizeof *pages);
+    node->pages = pages;
+    node->page_cnt = cnt;
+  }
+  if (!node->pages[idx] && create) {
+    node->pages[idx] = palloc_get_page(PAL_ZERO);
+  }
+  return node->pages[idx];
+}
+
+/* Reads up to SIZE bytes at OFFSET from the tmpfs inode SECTOR, whose
+   length is LENGTH, into BUFFER.  Returns the number of bytes read. */
+off_t tmpfs_read_at(disk_sector_t sector, void *buffer_, off_t size, off_t offset, off_t length) {
+  struct tmpfs_node *node = node_of(sector);
+  uint8_t *buffer = buffer_;
+  off_t bytes_read = 0;
+
+  lock_acquire(&tmpfs_lock);
+  while (size > 0 && offset < length) {
+    int page_ofs = offset % PGSIZE;
+    off_t chunk_size = PGSIZE - page_ofs;
+    if (chunk_size > size) {
+      chunk_size = size;
+    }
+    if (chunk_size > length - offset) {
+      chunk_size = length - offset;
+    }
+
+    uint8_t *page = get_page(node, offset / PGSIZE, false);
+    if (page) {
+      memcpy(buffer + bytes_read, page + page_ofs, chunk_size);
+    } else {
+      // hole
+      memset(buffer + bytes_read, 0, chunk_size);
+    }
+    size -= chunk_size;
+    offset += chunk_size;
+    bytes_read += chunk_size;
+  }
+  lock_release(&tmpfs_lock);
+  return bytes_read;
+}
+
+/* Writes SIZE bytes from BUFFER at OFFSET into the tmpfs inode SECTOR.
+   Returns the number of bytes written, less than SIZE if memory runs
+   out.  The caller updates the length. */
+off_t tmpfs_write_at(disk_sector_t sector, const void *buffer_, off_t size, off_t offset) {
+  struct tmpfs_node *node = node_of(sector);
+  const uint8_t *buffer = buffer_;
+  off_t bytes_written = 0;
+
+  lock_acquire(&tmpfs_lock);
+  while (size > 0) {
+    int page_ofs = offset % PGSIZE;
+    off_t chunk_size = PGSIZE - page_ofs;
+    if (chunk_size > size) {
+      chunk_size = size;
+    }
+
+    uint8_t *page = get_page(node, offset / PGSIZE, true);
+    if (!page) {
+      break;
+    }
+    memcpy(page + page_ofs, buffer + bytes_written, chunk_size);
+    size -= chunk_size;
+    offset += chunk_size;
+    bytes_written += chunk_size;
+  }
+  lock_release(&tmpfs_lock);
+  return bytes_written;
+}
+
+/* Allocates the pages backing bytes [OFFSET, OFFSET + SIZE) of the
+   tmpfs inode SECTOR.  Returns false if memory runs out. */
+bool tmpfs_fallocate(disk_sector_t sector, off_t offset, off_t size) {
+  struct tmpfs_node *node = node_of(sector);
+  size_t i;
+  bool success = true;
+
+  lock_acquire(&tmpfs_lock);
+  for (i=offset / PGSIZE; i<DIV_ROUND_UP((size_t) offset + size, PGSIZE); i++) {
+    if (!get_page(node, i, true)) {
+      success = false;
+      break;
+    }
+  }
+  lock_release(&tmpfs_lock);
+  return success;
+}
+
+/* Shrinks the tmpfs inode SECTOR from OLD_LENGTH to LENGTH bytes,
+   freeing whole pages past the end and clearing the tail of the
+   last one so that later growth reads zeros. */
+void tmpfs_truncate(disk_sector_t sector, off_t old_length, off_t length) {
+  struct tmpfs_node *node = node_of(sector);
+
+  if (length >= old_length) {
+    return;
+  }
+  lock_acquire(&tmpfs_lock);
+  free_pages_from(node, DIV_ROUND_UP(length, PGSIZE));
+  uint8_t *page = get_page(node, length / PGSIZE, false);
+  if (page && length % PGSIZE) {
+    memset(page + length % PGSIZE, 0, PGSIZE - length % PGSIZE);
+  }
+  lock_release(&tmpfs_lock);
+}
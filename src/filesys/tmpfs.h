@@ -0,0 +1,33 @@
+#ifndef FILESYS_TMPFS_H
+#define FILESYS_TMPFS_H
+
+#include <stdbool.h>
+#include "devices/disk.h"
+#include "filesys/off_t.h"
+
+struct inode_disk;
+
+// tmpfs inodes live only in kernel memory; their inode numbers are taken
+// from a range no disk reaches so the rest of the file system can tell them apart
+#define TMPFS_SECTOR_BASE 0xc0000000
+#define TMPFS_INODE_MAX 1024 // maximum number of tmpfs files and directories
+#define TMPFS_MOUNT_MAX 4 // maximum number of tmpfs mounts
+#define is_tmpfs_sector(SECTOR) ((SECTOR) >= TMPFS_SECTOR_BASE && (SECTOR) < TMPFS_SECTOR_BASE + TMPFS_INODE_MAX)
+
+void tmpfs_init(void);
+bool tmpfs_mount(disk_sector_t mountpoint, disk_sector_t parent_dir);
+disk_sector_t tmpfs_follow_mount(disk_sector_t sector);
+bool tmpfs_is_mountpoint(disk_sector_t sector);
+
+bool tmpfs_allocate(disk_sector_t *sectorp);
+bool tmpfs_create(disk_sector_t sector, off_t length, bool is_dir, disk_sector_t parent_dir);
+void tmpfs_load(disk_sector_t sector, struct inode_disk *data);
+void tmpfs_store(disk_sector_t sector, const struct inode_disk *data);
+void tmpfs_release(disk_sector_t sector);
+
+off_t tmpfs_read_at(disk_sector_t sector, void *buffer, off_t size, off_t offset, off_t length);
+off_t tmpfs_write_at(disk_sector_t sector, const void *buffer, off_t size, off_t offset);
+bool tmpfs_fallocate(disk_sector_t sector, off_t offset, off_t size);
+void tmpfs_truncate(disk_sector_t sector, off_t old_length, off_t length);
+
+#endif
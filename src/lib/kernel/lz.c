@@ -0,0 +1,216 @@
+#include "lz.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "../debug.h"
+
+/* Compressed format.
+
+   Each sequence starts with a token byte.  Its high nibble is
+   the number of literals that follow, its low nibble the match
+   length minus LZ_MIN_MATCH.  A nibble of 15 is continued by
+   extra bytes that are added to it, each 255 meaning another
+   byte follows.  Then come the literals, then a 2-byte
+   little-endian offset back into the output where the match
+   starts, then the match length's extra bytes.  The last
+   sequence has literals only: it ends at the end of the input. */
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 10
+#define LZ_MAX_OFFSET 65535
+
+/* Returns the 4 bytes at P, which need not be aligned. */
+static inline uint32_t
+read32 (const uint8_t *p)
+{
+  uint32_t v;
+  memcpy (&v, p, sizeof v);
+  return v;
+}
+
+/* Hashes the 4 bytes V to an index into the match table. */
+static inline unsigned
+hash4 (uint32_t v)
+{
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Writes length LEN, whose first 15 are already in a token
+   nibble, as extra bytes at *OP, not going past END.
+   Returns false if there is no room. */
+static bool
+put_length (uint8_t **op, uint8_t *end, size_t len)
+{
+  uint8_t *p = *op;
+
+  for (len -= 15; ; len -= 255)
+    {
+      if (p >= end)
+        return false;
+      if (len < 255)
+        {
+          *p++ = len;
+          break;
+        }
+      *p++ = 255;
+    }
+  *op = p;
+  return true;
+}
+
+/* Writes a sequence of LIT_LEN literals from LIT followed by a
+   match of MATCH_LEN bytes at OFFSET back, or no match if
+   MATCH_LEN is 0, at *OP, not going past END.
+   Returns false if there is no room. */
+static bool
+put_sequence (uint8_t **op, uint8_t *end, const uint8_t *lit,
+              size_t lit_len, size_t offset, size_t match_len)
+{
+  uint8_t *p = *op;
+  size_t match_code = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+
+  if (p >= end)
+    return false;
+  *p++ = ((lit_len < 15 ? lit_len : 15) << 4)
+         | (match_code < 15 ? match_code : 15);
+  if (lit_len >= 15 && !put_length (&p, end, lit_len))
+    return false;
+  if ((size_t) (end - p) < lit_len)
+    return false;
+  memcpy (p, lit, lit_len);
+  p += lit_len;
+
+  if (match_len > 0)
+    {
+      if (end - p < 2)
+        return false;
+      *p++ = offset & 0xff;
+      *p++ = offset >> 8;
+      if (match_code >= 15 && !put_length (&p, end, match_code))
+        return false;
+    }
+  *op = p;
+  return true;
+}
+
+/* Compresses the SRC_SIZE bytes at SRC into DST, which has room
+   for DST_SIZE bytes, using WORK, LZ_WORK_SIZE bytes of scratch
+   memory.  Returns the compressed size, or 0 if it would not
+   fit in DST_SIZE bytes. */
+size_t
+lz_compress (const void *src_, size_t src_size,
+             void *dst_, size_t dst_size, void *work)
+{
+  const uint8_t *src = src_;
+  const uint8_t *end = src + src_size;
+  const uint8_t *ip = src;
+  const uint8_t *anchor = src;
+  uint8_t *op = dst_;
+  uint8_t *op_end = op + dst_size;
+  uint16_t *table = work;
+
+  ASSERT (src_size <= LZ_MAX_INPUT);
+  ASSERT (sizeof *table << LZ_HASH_BITS == LZ_WORK_SIZE);
+
+  memset (table, 0, LZ_WORK_SIZE);
+  while (end - ip >= LZ_MIN_MATCH)
+    {
+      uint32_t v = read32 (ip);
+      unsigned h = hash4 (v);
+      const uint8_t *ref = src + table[h];
+      size_t len;
+
+      table[h] = ip - src;
+      if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32 (ref) != v)
+        {
+          ip++;
+          continue;
+        }
+
+      /* Extend the match as far as it goes.  It may overlap IP,
+         which is how runs are encoded. */
+      for (len = LZ_MIN_MATCH; ip + len < end && ref[len] == ip[len]; len++)
+        continue;
+      if (!put_sequence (&op, op_end, anchor, ip - anchor, ip - ref, len))
+        return 0;
+      ip += len;
+      anchor = ip;
+    }
+
+  if (!put_sequence (&op, op_end, anchor, end - anchor, 0, 0))
+    return 0;
+  return op - (uint8_t *) dst_;
+}
+
+/* Reads a length continued past a token nibble of 15 from *IP,
+   not going past END, adding it to *LEN.
+   Returns false if the input ends first. */
+static bool
+get_length (const uint8_t **ip, const uint8_t *end, size_t *len)
+{
+  const uint8_t *p = *ip;
+  uint8_t b;
+
+  do
+    {
+      if (p >= end)
+        return false;
+      b = *p++;
+      *len += b;
+    }
+  while (b == 255);
+  *ip = p;
+  return true;
+}
+
+/* Decompresses the SRC_SIZE bytes at SRC, produced by
+   lz_compress(), into DST, which has room for DST_SIZE bytes.
+   Returns the decompressed size, or 0 if SRC is corrupt or does
+   not fit. */
+size_t
+lz_decompress (const void *src_, size_t src_size,
+               void *dst_, size_t dst_size)
+{
+  const uint8_t *ip = src_;
+  const uint8_t *end = ip + src_size;
+  uint8_t *dst = dst_;
+  uint8_t *op = dst;
+  uint8_t *op_end = dst + dst_size;
+
+  while (ip < end)
+    {
+      uint8_t token = *ip++;
+      size_t lit_len = token >> 4;
+      size_t match_len = token & 0xf;
+      size_t offset;
+      const uint8_t *ref;
+
+      if (lit_len == 15 && !get_length (&ip, end, &lit_len))
+        return 0;
+      if ((size_t) (end - ip) < lit_len || (size_t) (op_end - op) < lit_len)
+        return 0;
+      memcpy (op, ip, lit_len);
+      ip += lit_len;
+      op += lit_len;
+
+      /* The last sequence has no match. */
+      if (ip == end)
+        break;
+
+      if (end - ip < 2)
+        return 0;
+      offset = ip[0] | (ip[1] << 8);
+      ip += 2;
+      if (match_len == 15 && !get_length (&ip, end, &match_len))
+        return 0;
+      match_len += LZ_MIN_MATCH;
+      if (offset == 0 || offset > (size_t) (op - dst)
+          || (size_t) (op_end - op) < match_len)
+        return 0;
+
+      /* Byte by byte, since the match may overlap its copy. */
+      for (ref = op - offset; match_len > 0; match_len--)
+        *op++ = *ref++;
+    }
+  return op - dst;
+}
@@ -0,0 +1,24 @@
+#ifndef __LIB_KERNEL_LZ_H
+#define __LIB_KERNEL_LZ_H
+
+#include <stddef.h>
+
+/* Fast LZ77 compression in the style of LZ4.
+
+   The compressed form is a sequence of (literals, match) pairs
+   and favors speed over ratio: it is meant for data that is
+   compressed and decompressed often, such as pages on their way
+   to swap.  Inputs are limited to 64 kB. */
+
+/* Size of the scratch memory lz_compress() needs. */
+#define LZ_WORK_SIZE (1024 * 2)
+
+/* Largest input lz_compress() accepts. */
+#define LZ_MAX_INPUT 65535
+
+size_t lz_compress (const void *src, size_t src_size,
+                    void *dst, size_t dst_size, void *work);
+size_t lz_decompress (const void *src, size_t src_size,
+                      void *dst, size_t dst_size);
+
+#endif /* lib/kernel/lz.h */
@@ -28,7 +28,13 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_FALLOCATE,              /* Reserve space for a file. */
+    SYS_TRUNCATE,               /* Change the size of a named file. */
+    SYS_FTRUNCATE,              /* Change the size of an open file. */
+    SYS_FORK                    /* Duplicate this process. */
   };
 
 #endif /* lib/syscall-nr.h */
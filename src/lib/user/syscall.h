@@ -45,4 +45,10 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+bool fallocate (int fd, unsigned offset, unsigned length);
+bool truncate (const char *file, unsigned length);
+bool ftruncate (int fd, unsigned length);
+pid_t fork (void);
+
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,36 @@
+/* Preallocates an empty file with fallocate, checks that the
+   reserved space reads back as zeros, then overwrites part of it
+   and checks that only that part changed. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 20000
+#define WRITE_OFS 5000
+
+static char buf[FILE_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  static const char data[] = "preallocated";
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (fallocate (fd, 0, FILE_SIZE), "fallocate %d bytes of \"%s\"",
+         FILE_SIZE, file_name);
+  check_file_handle (fd, file_name, buf, sizeof buf);
+
+  msg ("seek \"%s\"", file_name);
+  seek (fd, WRITE_OFS);
+  CHECK (write (fd, data, sizeof data - 1) == sizeof data - 1,
+         "write \"%s\"", file_name);
+  memcpy (buf + WRITE_OFS, data, sizeof data - 1);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(falloc-zero) begin
+(falloc-zero) create "testfile"
+(falloc-zero) open "testfile"
+(falloc-zero) fallocate 20000 bytes of "testfile"
+(falloc-zero) verified contents of "testfile"
+(falloc-zero) seek "testfile"
+(falloc-zero) write "testfile"
+(falloc-zero) close "testfile"
+(falloc-zero) open "testfile" for verification
+(falloc-zero) verified contents of "testfile"
+(falloc-zero) close "testfile"
+(falloc-zero) end
+EOF
+pass;
@@ -0,0 +1,20 @@
+/* Tries to truncate the executable of the running process, by
+   name and through a file descriptor.  Both must fail, since
+   writes to it are denied. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  int fd;
+
+  CHECK (!truncate ("trunc-exec", 0), "try to truncate \"trunc-exec\"");
+  CHECK ((fd = open ("trunc-exec")) > 1, "open \"trunc-exec\"");
+  CHECK (!ftruncate (fd, 0), "try to ftruncate \"trunc-exec\"");
+  CHECK (filesize (fd) > 0, "filesize \"trunc-exec\"");
+  msg ("close \"trunc-exec\"");
+  close (fd);
+}
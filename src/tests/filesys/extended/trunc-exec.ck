@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(trunc-exec) begin
+(trunc-exec) try to truncate "trunc-exec"
+(trunc-exec) open "trunc-exec"
+(trunc-exec) try to ftruncate "trunc-exec"
+(trunc-exec) filesize "trunc-exec"
+(trunc-exec) close "trunc-exec"
+(trunc-exec) end
+EOF
+pass;
@@ -0,0 +1,7 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_archive ({"testfile" => [substr (random_bytes (6000), 0, 500) . "\0" x 8500]});
+pass;
@@ -0,0 +1,36 @@
+/* Shrinks a file and then grows it again with truncate, and
+   checks that the grown part reads as zeros, not as the data that
+   was there before the file was shrunk. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define DATA_SIZE 6000
+#define SHORT_SIZE 500
+#define LONG_SIZE 9000
+
+static char buf[LONG_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  int fd;
+
+  random_bytes (buf, DATA_SIZE);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, DATA_SIZE) == DATA_SIZE, "write \"%s\"", file_name);
+  CHECK (ftruncate (fd, SHORT_SIZE), "ftruncate \"%s\" to %d bytes",
+         file_name, SHORT_SIZE);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  CHECK (truncate (file_name, LONG_SIZE), "truncate \"%s\" to %d bytes",
+         file_name, LONG_SIZE);
+  memset (buf + SHORT_SIZE, 0, LONG_SIZE - SHORT_SIZE);
+  check_file (file_name, buf, LONG_SIZE);
+}
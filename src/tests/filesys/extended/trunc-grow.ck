@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(trunc-grow) begin
+(trunc-grow) create "testfile"
+(trunc-grow) open "testfile"
+(trunc-grow) write "testfile"
+(trunc-grow) ftruncate "testfile" to 500 bytes
+(trunc-grow) close "testfile"
+(trunc-grow) truncate "testfile" to 9000 bytes
+(trunc-grow) open "testfile" for verification
+(trunc-grow) verified contents of "testfile"
+(trunc-grow) close "testfile"
+(trunc-grow) end
+EOF
+pass;
@@ -0,0 +1,30 @@
+/* Writes a file, shrinks it with ftruncate, and checks that
+   the file ends at the new length with its data intact. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define OLD_SIZE 10000
+#define NEW_SIZE 3000
+
+static char buf[OLD_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  int fd;
+
+  random_bytes (buf, sizeof buf);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, OLD_SIZE) == OLD_SIZE, "write \"%s\"", file_name);
+  CHECK (ftruncate (fd, NEW_SIZE), "ftruncate \"%s\" to %d bytes",
+         file_name, NEW_SIZE);
+  CHECK (filesize (fd) == NEW_SIZE, "filesize \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, NEW_SIZE);
+}
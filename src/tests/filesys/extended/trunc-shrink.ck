@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(trunc-shrink) begin
+(trunc-shrink) create "testfile"
+(trunc-shrink) open "testfile"
+(trunc-shrink) write "testfile"
+(trunc-shrink) ftruncate "testfile" to 3000 bytes
+(trunc-shrink) filesize "testfile"
+(trunc-shrink) close "testfile"
+(trunc-shrink) open "testfile" for verification
+(trunc-shrink) verified contents of "testfile"
+(trunc-shrink) close "testfile"
+(trunc-shrink) end
+EOF
+pass;
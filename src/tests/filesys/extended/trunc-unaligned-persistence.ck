@@ -0,0 +1,7 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_archive ({"testfile" => [substr (random_bytes (3000), 0, 1234) . "\0" x 3766 . "x"]});
+pass;
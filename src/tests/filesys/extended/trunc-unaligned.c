@@ -0,0 +1,40 @@
+/* Truncates a file to a length that is not a multiple of the
+   block size, then writes past the new end, and checks that the
+   rest of the last block was cleared rather than keeping the
+   data that followed the new end. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define DATA_SIZE 3000
+#define CUT_SIZE 1234
+#define WRITE_OFS 5000
+
+static char buf[WRITE_OFS + 1];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  int fd;
+
+  random_bytes (buf, DATA_SIZE);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, DATA_SIZE) == DATA_SIZE, "write \"%s\"", file_name);
+  CHECK (ftruncate (fd, CUT_SIZE), "ftruncate \"%s\" to %d bytes",
+         file_name, CUT_SIZE);
+
+  msg ("seek \"%s\"", file_name);
+  seek (fd, WRITE_OFS);
+  CHECK (write (fd, "x", 1) == 1, "write \"%s\" past the end", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  memset (buf + CUT_SIZE, 0, WRITE_OFS - CUT_SIZE);
+  buf[WRITE_OFS] = 'x';
+  check_file (file_name, buf, sizeof buf);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(trunc-unaligned) begin
+(trunc-unaligned) create "testfile"
+(trunc-unaligned) open "testfile"
+(trunc-unaligned) write "testfile"
+(trunc-unaligned) ftruncate "testfile" to 1234 bytes
+(trunc-unaligned) seek "testfile"
+(trunc-unaligned) write "testfile" past the end
+(trunc-unaligned) close "testfile"
+(trunc-unaligned) open "testfile" for verification
+(trunc-unaligned) verified contents of "testfile"
+(trunc-unaligned) close "testfile"
+(trunc-unaligned) end
+EOF
+pass;
@@ -0,0 +1,69 @@
+/* Forks several children from a process using more memory than
+   fits, then has all of them and the parent write the same pages
+   in the same order, so that they take copy-on-write faults on the
+   same shared frames at once, while frames must be evicted to make
+   the copies.  Each process must end up with only its own writes. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 1024 * 1024)
+#define PAGE_SIZE 4096
+#define CHILD_CNT 3
+
+static char buf[SIZE];
+
+/* Fails unless BUF is all C. */
+static void
+check_buf (char c, const char *who)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != c)
+      fail ("%s: byte %zu is %#x, not %#x", who, i, buf[i], c);
+}
+
+/* Writes C to BUF a page at a time, then checks that it is all C. */
+static void
+write_and_check (char c, const char *who)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    memset (buf + i, c, PAGE_SIZE);
+  check_buf (c, who);
+}
+
+void
+test_main (void)
+{
+  pid_t children[CHILD_CNT];
+  int i;
+
+  msg ("initialize");
+  memset (buf, 'p', sizeof buf);
+
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      children[i] = fork ();
+      if (children[i] == 0)
+        {
+          write_and_check ('a' + i, "child");
+          exit (i);
+        }
+      if (children[i] == -1)
+        fail ("fork returned -1");
+    }
+
+  msg ("write");
+  write_and_check ('P', "parent");
+
+  for (i = 0; i < CHILD_CNT; i++)
+    CHECK (wait (children[i]) == i, "wait for child %d", i);
+
+  msg ("read pass");
+  check_buf ('P', "parent");
+}
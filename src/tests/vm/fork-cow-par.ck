@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-cow-par) begin
+(fork-cow-par) initialize
+(fork-cow-par) write
+(fork-cow-par) wait for child 0
+(fork-cow-par) wait for child 1
+(fork-cow-par) wait for child 2
+(fork-cow-par) read pass
+(fork-cow-par) end
+EOF
+pass;
@@ -0,0 +1,57 @@
+/* Forks a child and checks that, after the fork, writes by
+   either process are not seen by the other, including writes to
+   a page that neither touched before the fork. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (16 * 4096)
+
+static char buf[SIZE];
+static char untouched[4096];
+
+/* Fails unless all SIZE bytes of BUF are C. */
+static void
+check_buf (char c, const char *who)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != c)
+      fail ("%s: byte %zu is %#x, not %#x", who, i, buf[i], c);
+}
+
+void
+test_main (void)
+{
+  pid_t pid;
+  size_t i;
+
+  msg ("initialize");
+  memset (buf, 'p', sizeof buf);
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      /* Whether the parent has written yet or not, the child sees
+         the memory as it was at the fork. */
+      check_buf ('p', "child");
+      memset (buf, 'c', sizeof buf);
+      check_buf ('c', "child");
+      untouched[0] = 'c';
+      exit (0x42);
+    }
+  if (pid == -1)
+    fail ("fork returned -1");
+
+  memset (buf, 'P', sizeof buf);
+  CHECK (wait (pid) == 0x42, "wait for child");
+
+  msg ("read pass");
+  check_buf ('P', "parent");
+  for (i = 0; i < sizeof untouched; i++)
+    if (untouched[i] != 0)
+      fail ("parent: untouched byte %zu is %#x, not 0", i, untouched[i]);
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-cow) begin
+(fork-cow) initialize
+(fork-cow) wait for child
+(fork-cow) read pass
+(fork-cow) end
+EOF
+pass;
@@ -0,0 +1,76 @@
+/* Forks several children from a process using more memory than
+   fits.  Each child writes its own part of the memory and exits
+   while the parent keeps rewriting all of it, so that the
+   children's copies are made and torn down under memory
+   pressure.  The parent's memory must come out intact. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 1024 * 1024)
+#define CHILD_CNT 4
+#define PASS_CNT 2
+
+static char buf[SIZE];
+
+/* Byte expected at offset I after PASS passes. */
+static char
+pattern (size_t i, int pass)
+{
+  return i * 31 + (i >> 12) + pass;
+}
+
+/* Rewrites the part of BUF that belongs to child IDX, checks it,
+   and exits. */
+static void
+child (int idx)
+{
+  size_t start = SIZE / CHILD_CNT * idx;
+  size_t end = start + SIZE / CHILD_CNT;
+  size_t i;
+
+  for (i = start; i < end; i++)
+    if (buf[i] != pattern (i, 0))
+      fail ("child %d: byte %zu is wrong", idx, i);
+  for (i = start; i < end; i++)
+    buf[i] = idx;
+  for (i = start; i < end; i++)
+    if (buf[i] != idx)
+      fail ("child %d: byte %zu is wrong after write", idx, i);
+  exit (idx);
+}
+
+void
+test_main (void)
+{
+  pid_t children[CHILD_CNT];
+  size_t i;
+  int pass;
+
+  msg ("initialize");
+  for (i = 0; i < SIZE; i++)
+    buf[i] = pattern (i, 0);
+
+  for (pass = 0; pass < CHILD_CNT; pass++)
+    {
+      children[pass] = fork ();
+      if (children[pass] == 0)
+        child (pass);
+      if (children[pass] == -1)
+        fail ("fork returned -1");
+    }
+
+  msg ("read/modify/write");
+  for (pass = 1; pass <= PASS_CNT; pass++)
+    for (i = 0; i < SIZE; i++)
+      buf[i]++;
+
+  for (pass = 0; pass < CHILD_CNT; pass++)
+    CHECK (wait (children[pass]) == pass, "wait for child %d", pass);
+
+  msg ("read pass");
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != pattern (i, PASS_CNT))
+      fail ("parent: byte %zu is wrong", i);
+}
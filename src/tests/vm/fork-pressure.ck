@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-pressure) begin
+(fork-pressure) initialize
+(fork-pressure) read/modify/write
+(fork-pressure) wait for child 0
+(fork-pressure) wait for child 1
+(fork-pressure) wait for child 2
+(fork-pressure) wait for child 3
+(fork-pressure) read pass
+(fork-pressure) end
+EOF
+pass;
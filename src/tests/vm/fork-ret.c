@@ -0,0 +1,21 @@
+/* Forks a child and checks that fork() returns 0 in the child
+   and the child's pid in the parent. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  pid_t pid = fork ();
+
+  if (pid == 0)
+    {
+      msg ("child: fork returned 0");
+      exit (81);
+    }
+  if (pid == -1)
+    fail ("fork returned -1");
+  CHECK (wait (pid) == 81, "wait for child");
+}
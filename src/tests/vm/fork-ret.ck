@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-ret) begin
+(fork-ret) child: fork returned 0
+(fork-ret) wait for child
+(fork-ret) end
+EOF
+pass;
@@ -0,0 +1,51 @@
+/* Fills 2 MB of memory, more than fits, so that much of it is
+   swapped out, then forks.  The child must see the same
+   contents and its writes must not reach the parent. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 1024 * 1024)
+
+static char buf[SIZE];
+
+/* Byte expected at offset I, varying from page to page. */
+static char
+pattern (size_t i)
+{
+  return i * 31 + (i >> 12);
+}
+
+void
+test_main (void)
+{
+  pid_t pid;
+  size_t i;
+
+  msg ("initialize");
+  for (i = 0; i < SIZE; i++)
+    buf[i] = pattern (i);
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      for (i = 0; i < SIZE; i++)
+        if (buf[i] != pattern (i))
+          fail ("child: byte %zu is wrong", i);
+      for (i = 0; i < SIZE; i++)
+        buf[i] = ~pattern (i);
+      for (i = 0; i < SIZE; i++)
+        if (buf[i] != (char) ~pattern (i))
+          fail ("child: byte %zu is wrong after write", i);
+      exit (0x42);
+    }
+  if (pid == -1)
+    fail ("fork returned -1");
+  CHECK (wait (pid) == 0x42, "wait for child");
+
+  msg ("read pass");
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != pattern (i))
+      fail ("parent: byte %zu is wrong", i);
+}
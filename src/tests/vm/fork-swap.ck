@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-swap) begin
+(fork-swap) initialize
+(fork-swap) wait for child
+(fork-swap) read pass
+(fork-swap) end
+EOF
+pass;
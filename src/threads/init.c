@@ -31,9 +31,12 @@
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
+#include "devices/iosched.h"
+#include "devices/ramdisk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #include "filesys/directory.h"
+#include "filesys/inode.h"
 #endif
 
 #ifdef PR_VM
@@ -50,6 +53,15 @@ uint32_t *base_page_dir;
 #ifdef FILESYS
 /* -f: Format the file system? */
 static bool format_filesys;
+
+/* -bs: Block size in bytes to format the file system with. */
+static size_t format_block_size = DISK_SECTOR_SIZE;
+
+/* -ramdisk: Size of the RAM disk in kB, 0 for none. */
+static size_t ramdisk_size;
+
+/* -tmpfs: Directory to mount an in-memory file system on. */
+static const char *tmpfs_path;
 #endif
 
 /* -q: Power off after kernel tasks complete? */
@@ -118,7 +130,10 @@ main (void)
 #ifdef FILESYS
   /* Initialize file system. */
   disk_init ();
-  filesys_init (format_filesys);
+  ramdisk_init (ramdisk_size * 1024);
+  filesys_init (format_filesys, format_block_size);
+  if (tmpfs_path != NULL && !filesys_mount_tmpfs (tmpfs_path))
+    PANIC ("cannot mount tmpfs on %s", tmpfs_path);
 #endif
 
   #ifdef PR_VM
@@ -232,6 +247,16 @@ read_command_line (void)
   return argv;
 }
 
+#ifdef FILESYS
+/* Handles option NAME=VALUE, which picks the disk for ROLE. */
+static void
+set_disk_role (enum disk_role role, const char *name, const char *value)
+{
+  if (value == NULL || !disk_set_role (role, value))
+    PANIC ("bad disk name for %s", name);
+}
+#endif
+
 /* Parses options in ARGV[]
    and returns the first non-option argument. */
 static char **
@@ -250,6 +275,34 @@ parse_options (char **argv)
 #ifdef FILESYS
       else if (!strcmp (name, "-f"))
         format_filesys = true;
+      else if (!strcmp (name, "-bs"))
+        {
+          format_block_size = atoi (value);
+          if (format_block_size < DISK_SECTOR_SIZE
+              || format_block_size > FS_BLOCK_SIZE_MAX
+              || format_block_size % DISK_SECTOR_SIZE != 0)
+            PANIC ("block size must be a multiple of %d up to %d",
+                   DISK_SECTOR_SIZE, FS_BLOCK_SIZE_MAX);
+        }
+      else if (!strcmp (name, "-fs-disk"))
+        set_disk_role (DISK_FILESYS, name, value);
+      else if (!strcmp (name, "-swap-disk"))
+        set_disk_role (DISK_SWAP, name, value);
+      else if (!strcmp (name, "-scratch-disk"))
+        set_disk_role (DISK_SCRATCH, name, value);
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_size = atoi (value);
+      else if (!strcmp (name, "-tmpfs"))
+        {
+          if (value == NULL || value[0] != '/')
+            PANIC ("tmpfs mountpoint must be an absolute path");
+          tmpfs_path = value;
+        }
+      else if (!strcmp (name, "-iosched"))
+        {
+          if (value == NULL || !iosched_select (value))
+            PANIC ("unknown I/O scheduler \"%s\"", value ? value : "");
+        }
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
@@ -292,6 +345,16 @@ run_task (char **argv)
   printf ("Execution of '%s' complete.\n", task);
 }
 
+#ifdef FILESYS
+/* Prints the I/O statistics of every disk so far, e.g. after
+   a `run' action. */
+static void
+print_disk_stats (char **argv UNUSED)
+{
+  disk_print_stats ();
+}
+#endif
+
 /* Executes all of the actions specified in ARGV[]
    up to the null pointer sentinel. */
 static void
@@ -315,6 +378,7 @@ run_actions (char **argv)
       {"rm", 2, fsutil_rm},
       {"put", 2, fsutil_put},
       {"get", 2, fsutil_get},
+      {"diskstats", 1, print_disk_stats},
 #endif
       {NULL, 0, NULL},
     };
@@ -361,6 +425,7 @@ usage (void)
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
           "  rm FILE            Delete FILE.\n"
+          "  diskstats          Print per-disk I/O statistics so far.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  put FILE           Put FILE into file system from scratch disk.\n"
           "  get FILE           Get FILE from file system into scratch disk.\n"
@@ -369,6 +434,15 @@ usage (void)
           "  -h                 Print this help message and power off.\n"
           "  -q                 Power off VM after actions or on panic.\n"
           "  -f                 Format file system disk during startup.\n"
+#ifdef FILESYS
+          "  -bs=BYTES          Format with BYTES-byte blocks, e.g. 4096.\n"
+          "  -iosched=POLICY    Use disk I/O scheduler noop, cscan or deadline.\n"
+          "  -fs-disk=DISK      Use DISK (e.g. hd0:1, vd0) for the file system.\n"
+          "  -swap-disk=DISK    Use DISK (e.g. hd1:1, vd1) for swap.\n"
+          "  -scratch-disk=DISK Use DISK (e.g. hd1:0) as the scratch disk.\n"
+          "  -ramdisk=KB        Create a KB-kB RAM disk rd0, e.g. for swap.\n"
+          "  -tmpfs=DIR         Mount an in-memory file system on DIR.\n"
+#endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
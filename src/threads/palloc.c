@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -32,6 +33,8 @@ struct pool
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
     uint8_t *base;                      /* Base of pool. */
+    size_t free_cnt;                    /* Number of free pages.
+                                           Updated with interrupts off. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -43,6 +46,7 @@ size_t user_page_limit = SIZE_MAX;
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static void adjust_free_cnt (struct pool *, int delta);
 
 /* Initializes the page allocator. */
 void
@@ -87,6 +91,8 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   lock_acquire (&pool->lock);
   page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
   lock_release (&pool->lock);
+  if (page_idx != BITMAP_ERROR)
+    adjust_free_cnt (pool, -(int) page_cnt);
 
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
@@ -146,6 +152,40 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  adjust_free_cnt (pool, page_cnt);
+}
+
+/* Returns the number of free pages in the user pool if PAL_USER
+   is set in FLAGS, otherwise in the kernel pool.  The count may
+   be stale by the time the caller looks at it. */
+size_t
+palloc_free_count (enum palloc_flags flags)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+
+  return pool->free_cnt;
+}
+
+/* Returns the first page of the user pool if PAL_USER is set in
+   FLAGS, otherwise of the kernel pool.  The pool's pages are
+   contiguous, so a page's index within its pool is its distance
+   from the base in pages. */
+void *
+palloc_pool_base (enum palloc_flags flags)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+
+  return pool->base;
+}
+
+/* Returns the total number of pages in the user pool if PAL_USER
+   is set in FLAGS, otherwise in the kernel pool. */
+size_t
+palloc_page_count (enum palloc_flags flags)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+
+  return bitmap_size (pool->used_map);
 }
 
 /* Frees the page at PAGE. */
@@ -174,6 +214,19 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
   lock_init (&p->lock);
   p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
   p->base = base + bm_pages * PGSIZE;
+  p->free_cnt = page_cnt;
+}
+
+/* Adds DELTA to POOL's free page count.  Pages may be freed with
+   interrupts off, e.g. when a dying thread's stack is released,
+   so the count is protected by disabling interrupts rather than
+   by POOL's lock. */
+static void
+adjust_free_cnt (struct pool *pool, int delta)
+{
+  enum intr_level old_level = intr_disable ();
+  pool->free_cnt += delta;
+  intr_set_level (old_level);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -174,6 +174,10 @@ page_fault (struct intr_frame *f)
    #ifdef PR_VM
    // writing to read only page
    if (!not_present) {
+      // copy-on-write page shared with a forked process
+      if (write && frame_cow_fault((uint8_t *)pg_round_down(fault_addr))) {
+         return;
+      }
       // terminates process, instead of killing it
       process_current()->status = PID_ERROR;
       thread_exit();
@@ -182,17 +186,18 @@ page_fault (struct intr_frame *f)
    // memory of fault_addr was swapped out
    uint8_t *page = (uint8_t *)pg_round_down(fault_addr);
    lock_acquire(&frame_table.lock);
-   struct page_table_entry *pte = page_table_find(&process_current()->page_table, page);
+   bool mapped = page_table_contains(&process_current()->page_table, page);
    lock_release(&frame_table.lock);
 
-   // page table entry does not exist
-   if (pte == NULL) {
+   // neither a page table entry nor a region
+   if (!mapped) {
       if (user) {
         // no space between kernel and user stack. just check whether fault address is within the boundary
         if (is_user_vaddr(fault_addr) && (uint8_t *)f->esp - 32 <= fault_addr) {
-            // stack growth
-            allocate_frame(page, true, PAL_ZERO);
-            return;
+            // stack growth, zero-filled on demand below
+            lock_acquire(&frame_table.lock);
+            page_table_insert_anon(&process_current()->page_table, page);
+            lock_release(&frame_table.lock);
         } else {
             process_current()->status = PID_ERROR;
             thread_exit();
@@ -200,9 +205,10 @@ page_fault (struct intr_frame *f)
       } else {
         // stack memory allocation caused by system call
         if ((uint8_t *)process_current()->esp - 32 <= fault_addr) {
-            // stack growth
-            allocate_frame(page, true, PAL_ZERO);
-            return;
+            // stack growth, zero-filled on demand below
+            lock_acquire(&frame_table.lock);
+            page_table_insert_anon(&process_current()->page_table, page);
+            lock_release(&frame_table.lock);
         } else {
             process_current()->status = PID_ERROR;
             thread_exit();
@@ -210,124 +216,8 @@ page_fault (struct intr_frame *f)
       }
    }
 
-   // exists inside disk
-   if (pte->disk) {
-      lock_acquire(&frame_table.lock);
-      uint8_t *frame = palloc_get_page(PAL_USER);
-
-      // no remaining frame
-      if (frame == NULL) {
-        // select victim frame
-        frame = frame_table_select_victim();
-        struct frame_table_entry *vfte = frame_table_find(frame);
-        struct page_table_entry *vpte = page_table_find(&vfte->owner->page_table, vfte->page);
-
-        // fill in pte
-        bool writable = true;
-        pagedir_clear_page(thread_current()->pagedir, page);
-        pagedir_set_page(thread_current()->pagedir, page, frame, writable);
-
-        // victim frame mapped to file
-        if (vpte->file) {
-          // file out
-          lock_acquire(&lock_file);
-          file_write_at(vpte->file, vpte->frame, PGSIZE, vpte->offset);
-          lock_release(&lock_file);
-
-          // update page table for file out page(process)
-          page_table_insert_file(&vfte->owner->page_table, vfte->page, vpte->file, vpte->offset);
-        } else {
-            // swap out, what if disk full?
-            disk_sector_t block = swap_out(frame);
-
-            // update page table for swapped out page(process)
-            page_table_insert_block(&vfte->owner->page_table, vfte->page, block);
-        }
-
-        pagedir_clear_page(vfte->owner->thread->pagedir, vfte->page); // clear page
-
-        // swap in
-        swap_in(pte->block, frame);
-
-        // update frame table and page table for current process
-        frame_table_insert(process_current(), frame, page);
-        page_table_insert_frame(&process_current()->page_table, page, frame);
-      } else {
-        // fill in pte
-        bool writable = true; // WARNING: need to change this
-        pagedir_clear_page(thread_current()->pagedir, page);
-        pagedir_set_page(thread_current()->pagedir, page, frame, writable);
-
-        // swap in
-        swap_in(pte->block, frame);
-
-        // update frame table and page table
-        frame_table_insert(process_current(), frame, page);
-        page_table_insert_frame(&process_current()->page_table, page, frame);
-      }
-      lock_release(&frame_table.lock);
-   }
-   // exists inside file
-   else if (pte->file) {
-     lock_acquire(&frame_table.lock);
-     uint8_t *frame = palloc_get_page(PAL_USER);
-
-     // no remaining frame
-     if (frame == NULL) {
-       // select victim frame
-       frame = frame_table_select_victim();
-       struct frame_table_entry *vfte = frame_table_find(frame);
-       struct page_table_entry *vpte = page_table_find(&vfte->owner->page_table, vfte->page);
-
-       // fill in pte
-       bool writable = true;
-       pagedir_clear_page(thread_current()->pagedir, page);
-       pagedir_set_page(thread_current()->pagedir, page, frame, writable);
-
-       // victim frame mapped to file
-       if (vpte->file) {
-         // file out
-         lock_acquire(&lock_file);
-         file_write_at(vpte->file, vpte->frame, PGSIZE, vpte->offset);
-         lock_release(&lock_file);
-
-         // update page table for file out page(process)
-         page_table_insert_file(&vfte->owner->page_table, vfte->page, vpte->file, vpte->offset);
-       } else {
-           // swap out, what if disk full?
-           disk_sector_t block = swap_out(frame);
-
-           // update page table for swapped out page(process)
-           page_table_insert_block(&vfte->owner->page_table, vfte->page, block);
-       }
-
-       pagedir_clear_page(vfte->owner->thread->pagedir, vfte->page); // clear page
-
-       // file in
-       lock_acquire(&lock_file);
-       file_read_at(pte->file, frame, PGSIZE, pte->offset);
-       lock_release(&lock_file);
-
-       // update frame table and page table for current process
-       frame_table_insert(process_current(), frame, page);
-       page_table_insert_frame(&process_current()->page_table, page, frame);
-     } else {
-       // fill in pte
-       bool writable = true; // WARNING: need to change this
-       pagedir_clear_page(thread_current()->pagedir, page);
-       pagedir_set_page(thread_current()->pagedir, page, frame, writable);
-
-       // file in
-       lock_acquire(&lock_file);
-       file_read_at(pte->file, frame, PGSIZE, pte->offset);
-       lock_release(&lock_file);
-
-       // update frame table and page table
-       frame_table_insert(process_current(), frame, page);
-       page_table_insert_frame(&process_current()->page_table, page, frame);
-     }
-     lock_release(&frame_table.lock);
-   } else {
+   // swapped out, dropped, or not yet read from its file
+   if (!frame_page_in(page, write)) {
      kill(f);
    }
    #else
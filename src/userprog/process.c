@@ -14,11 +14,23 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 
 static thread_func start_process NO_RETURN;
+#ifdef PR_VM
+static thread_func start_fork NO_RETURN;
+static bool fork_address_space (struct process *parent);
+
+/* What a forked child needs from its parent. */
+struct fork_args
+  {
+    struct intr_frame if_;      /* Parent's user registers at fork(). */
+    struct process *parent;
+  };
+#endif
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 
 #ifdef PR_USER
@@ -145,23 +157,26 @@ struct mmap *mmap_find(mapid_t mapid) {
 void mmap_write_back(mapid_t mapid) {
   struct process *p = process_current();
   struct mmap *mmap = mmap_find(mapid);
-  off_t len = file_length(mmap->file);
-  int i;
+  struct vma *vma = page_table_find_vma(&p->page_table, mmap->page);
 
   #ifdef DEBUG
-  printf("[mmap_write_back] page: %x, len: %u\n", mmap->page, len);
+  printf("[mmap_write_back] page: %x\n", mmap->page);
   #endif
 
-  for (i=0; i<len / PGSIZE + 1; i++) {
-    struct page_table_entry *pte = page_table_find(&p->page_table, mmap->page + i * PGSIZE);
-    if (pte->frame &&
-      pagedir_is_dirty(p->thread->pagedir, pte->page)) {
-      file_write_at(mmap->file, pte->frame, PGSIZE, pte->offset);
-      // remove from supplementary page table
+  // pages never touched have no entry, the others are on the region's list
+  while (!list_empty(&vma->pages)) {
+    struct page_table_entry *pte = list_entry(list_front(&vma->pages), struct page_table_entry, vma_elem);
+    if (pte->frame) {
+      if (pagedir_is_dirty(p->thread->pagedir, pte->page)) {
+        file_write_at(mmap->file, pte->frame, PGSIZE, pte->offset);
+      }
+      // remove from frame table, clean or not, so the clock never sees it
       frame_table_remove(pte->frame);
+      palloc_free_page(pte->frame);
     }
     page_table_remove(&p->page_table, pte->page);
   }
+  page_table_remove_vma(&p->page_table, mmap->page);
 }
 
 void mmap_free(mapid_t mapid) {
@@ -243,6 +258,131 @@ process_execute (const char *file_name)
   return tid;
 }
 
+#ifdef PR_VM
+/* Starts a new process that is a copy of the current one, which
+   called fork() with user registers F.  The child returns 0 from
+   fork() and shares the parent's memory copy-on-write.  Returns
+   the child's thread id, or TID_ERROR if it cannot be created. */
+tid_t
+process_fork (struct intr_frame *f)
+{
+  struct process *parent = process_current ();
+  struct fork_args *args;
+  tid_t tid;
+
+  args = malloc (sizeof *args);
+  if (args == NULL)
+    return TID_ERROR;
+  args->if_ = *f;
+  args->parent = parent;
+
+  tid = thread_create (parent->argv[0], PRI_DEFAULT, start_fork, args);
+  if (tid == TID_ERROR) {
+    free (args);
+    return tid;
+  }
+
+  /* As in process_execute(), wait until the child has copied what it
+     needs; the parent's memory must not change meanwhile. */
+  struct process *child = get_thread(tid)->process;
+  list_push_back(&parent->children, &child->elem);
+
+  #ifdef PR_FS
+  child->dir = dir_reopen(parent->dir);
+  #endif
+
+  lock_acquire(&child->lock_exec);
+  while (!child->load) {
+    cond_wait(&child->cond_load_done, &child->lock_exec);
+  }
+  lock_release(&child->lock_exec);
+
+  if (!child->success) {
+    return TID_ERROR;
+  }
+  return tid;
+}
+
+/* Copies the current process's name, open files and address space
+   from PARENT.  Returns true if successful. */
+static bool
+fork_address_space (struct process *parent)
+{
+  struct thread *t = thread_current ();
+  struct process *p = process_current ();
+  int i;
+
+  p->name = palloc_get_page (0);
+  if (p->name == NULL)
+    return false;
+  memcpy (p->name, parent->name, PGSIZE);
+  p->argc = parent->argc;
+  for (i = 0; i < parent->argc; i++)
+    p->argv[i] = p->name + (parent->argv[i] - parent->name);
+
+  t->pagedir = pagedir_create ();
+  if (t->pagedir == NULL)
+    return false;
+  process_activate ();
+
+  /* Open files are reopened at the same position. */
+  lock_acquire (&lock_file);
+  p->exec = file_reopen (parent->exec);
+  if (p->exec != NULL)
+    file_deny_write (p->exec);
+  for (i = MIN_FILE_COUNT; i < MAX_FILE_COUNT; i++)
+    if (parent->files[i]) {
+      p->files[i] = file_reopen (parent->files[i]);
+      if (p->files[i] != NULL)
+        file_seek (p->files[i], file_tell (parent->files[i]));
+    }
+  lock_release (&lock_file);
+  if (p->exec == NULL)
+    return false;
+
+  return frame_table_fork (parent, p);
+}
+
+/* A thread function that makes a forked process start running
+   where its parent called fork(). */
+static void
+start_fork (void *args_)
+{
+  struct fork_args *args = args_;
+  struct process *p = process_current();
+  struct intr_frame if_ = args->if_;
+  bool success;
+
+  lock_acquire(&p->lock_exec);
+  lock_acquire(&p->lock_wait);
+
+  success = fork_address_space (args->parent);
+  free (args);
+
+  /* Signals to parent that copying is done. */
+  p->success = success;
+  p->load = true;
+
+  cond_signal(&p->cond_load_done, &p->lock_exec);
+  lock_release(&p->lock_exec);
+
+  if (!success)
+    {
+      /* process_exit() only closes the executable of a process that
+         started. */
+      lock_acquire (&lock_file);
+      file_close (p->exec);
+      lock_release (&lock_file);
+      thread_exit ();
+    }
+
+  /* The child returns 0 from fork(). */
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+#endif
+
 /* A thread function that loads a user process and makes it start
    running. */
 static void
@@ -371,6 +511,8 @@ process_exit (void)
 
   #ifdef PR_VM
   lock_acquire(&frame_table.lock);
+  // pages still being written out or read in refer to the page table
+  frame_wait_idle(p);
   if (!lock_held_by_current_thread(&lock_file)) {
       lock_acquire(&lock_file);
   }
@@ -735,6 +877,17 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
+  #ifdef PR_VM
+  /* Record the segment as one region; page_fault() reads each page
+     in on first touch, so only the pages actually used are loaded. */
+  bool success;
+  lock_acquire(&frame_table.lock);
+  success = page_table_insert_vma(&process_current()->page_table, upage,
+                                  (read_bytes + zero_bytes) / PGSIZE, PAGE_ELF,
+                                  file, ofs, read_bytes, writable);
+  lock_release(&frame_table.lock);
+  return success;
+  #else
   file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0)
     {
@@ -745,22 +898,9 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
       /* Get a page of memory. */
-      #ifndef PR_VM
       uint8_t *kpage = palloc_get_page (PAL_USER);
-      #endif
-
-      /**
-       * fill in frame table and page table according to the mapped segments.
-       *
-       * WARNING : consider synchronization
-       */
-      #ifdef PR_VM
-      // allocate frame. returns NULL if fails.
-      uint8_t *kpage = allocate_frame(upage, writable, 0);
-      #else
       if (kpage == NULL)
         return false;
-      #endif
 
       /* Load this page. */
       if (file_read (file, kpage, page_read_bytes) != (int) page_read_bytes)
@@ -771,25 +911,20 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       memset (kpage + page_read_bytes, 0, page_zero_bytes);
 
       /* Add the page to the process's address space. */
-      #ifdef PR_VM
-      if (kpage == NULL) {
-        return false;
-      }
-      #else
       if (!install_page (upage, kpage, writable))
         {
           palloc_free_page (kpage);
           return false;
         }
-      #endif
 
       /* Advance. */
-
       read_bytes -= page_read_bytes;
       zero_bytes -= page_zero_bytes;
       upage += PGSIZE;
+      ofs += PGSIZE;
     }
   return true;
+  #endif
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
@@ -807,6 +942,7 @@ setup_stack (void **esp)
   uint8_t *page = (uint8_t *)PHYS_BASE - PGSIZE;
   uint8_t *frame = allocate_frame(page, true, PAL_ZERO);
   if (frame != NULL) {
+    frame_unpin(frame);
     success = true;
     *esp = PHYS_BASE;
   }
@@ -121,6 +121,10 @@ void process_print(void);
 #endif
 
 tid_t process_execute (const char *file_name);
+#ifdef PR_VM
+struct intr_frame;
+tid_t process_fork (struct intr_frame *f);
+#endif
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
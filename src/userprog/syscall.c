@@ -21,7 +21,7 @@
 #include "threads/malloc.h"
 #endif
 
-#define SYSCALL_COUNT 20
+#define SYSCALL_COUNT 24
 
 extern struct lock lock_file;
 
@@ -59,6 +59,13 @@ void sys_mkdir(struct intr_frame *f);
 void sys_readdir(struct intr_frame *f);
 void sys_isdir(struct intr_frame *f);
 void sys_inumber(struct intr_frame *f);
+void sys_fallocate(struct intr_frame *f);
+void sys_truncate(struct intr_frame *f);
+void sys_ftruncate(struct intr_frame *f);
+#endif
+
+#ifdef PR_VM
+void sys_fork(struct intr_frame *f);
 #endif
 
 #endif
@@ -86,7 +93,7 @@ bool is_valid(void *uaddr, void *esp) {
 
   #ifdef PR_VM
   uint8_t *page = pg_round_down(uaddr);
-  if (!(page_table_find(&process_current()->page_table, page) || (uint8_t *)esp <= page)) {
+  if (!(page_table_contains(&process_current()->page_table, page) || (uint8_t *)esp <= page)) {
     return false;
   }
   #else
@@ -432,15 +439,14 @@ void sys_mmap(struct intr_frame *f) {
     return;
   }
 
-  int i;
-  // validity check
-  for (i=0; i<len / PGSIZE + 1; i++) {
-    if (page_table_find(&p->page_table, page + i * PGSIZE)) {
-      lock_release(&lock_file);
-      lock_release(&frame_table.lock);
-      f->eax = -1;
-      return;
-    }
+  // one region for the whole file; fails if it overlaps mapped pages
+  struct file *file = file_reopen(p->files[fd]);
+  if (!page_table_insert_vma(&p->page_table, page, len / PGSIZE + 1, PAGE_MMAP, file, 0, len, true)) {
+    file_close(file);
+    lock_release(&lock_file);
+    lock_release(&frame_table.lock);
+    f->eax = -1;
+    return;
   }
 
   // select mmap id;
@@ -457,16 +463,11 @@ void sys_mmap(struct intr_frame *f) {
   struct mmap *mmap = (struct mmap *)malloc(sizeof(struct mmap));
   mmap->mapid = mapid;
   mmap->page = page;
-  mmap->file = file_reopen(p->files[fd]);
+  mmap->file = file;
 
   // push back
   list_push_back(&p->mmap_list, &mmap->elem);
 
-  // page talbe mapping
-  for (i=0; i<len / PGSIZE + 1; i++) {
-    page_table_insert_file(&p->page_table, page + i * PGSIZE, mmap->file, i * PGSIZE);
-  }
-
   lock_release(&lock_file);
   lock_release(&frame_table.lock);
 
@@ -486,6 +487,7 @@ void sys_munmap(struct intr_frame *f) {
   }
 
   lock_acquire(&frame_table.lock);
+  frame_wait_idle(process_current());
   lock_acquire(&lock_file);
 
   mmap_write_back(mapid);
@@ -497,6 +499,14 @@ void sys_munmap(struct intr_frame *f) {
   return;
 }
 
+void sys_fork(struct intr_frame *f) {
+  #ifdef DEBUG
+  printf("[sys_fork]\n");
+  #endif
+
+  f->eax = process_fork(f);
+}
+
 #endif
 
 #ifdef PR_FS
@@ -614,11 +624,11 @@ void sys_mkdir(struct intr_frame *f) {
   // final creation
   disk_sector_t inode_sector = 0;
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
+                  && inode_allocate (dir->inode, &inode_sector)
                   && dir_create(inode_sector, 0, dir->inode->sector) // create 0 entries
                   && dir_add (dir, final, inode_sector));
   if (!success && inode_sector != 0)
-    free_map_release (inode_sector, 1);
+    inode_release (inode_sector);
   dir_close (dir);
   free(temp);
 
@@ -682,6 +692,81 @@ void sys_inumber(struct intr_frame *f) {
   f->eax = p->files[fd]->inode->sector;
 }
 
+void sys_fallocate(struct intr_frame *f) {
+  int fd = get_integer(f->esp, 1);
+  unsigned int offset = get_integer(f->esp, 2);
+  unsigned int length = get_integer(f->esp, 3);
+
+  #ifdef DEBUG
+  printf("[sys_fallocate] fd: %d, offset: %u, length: %u\n", fd, offset, length);
+  #endif
+
+  if (fd == STDIN_FILENO || fd == STDOUT_FILENO || !process_valid_fd(fd)) {
+    f->eax = 0;
+    return;
+  }
+
+  struct process *p = process_current();
+  if (p->files[fd]->inode->data.is_dir) {
+    f->eax = 0;
+    return;
+  }
+  lock_acquire(&lock_file);
+  f->eax = file_allocate(p->files[fd], offset, length);
+  lock_release(&lock_file);
+}
+
+void sys_truncate(struct intr_frame *f) {
+  const char *name = get_pointer(f->esp, 1);
+  unsigned int length = get_integer(f->esp, 2);
+
+  #ifdef DEBUG
+  printf("[sys_truncate] name: %s, length: %u\n", name, length);
+  #endif
+
+  if (!name || !strcmp(name, "")) {
+    f->eax = 0;
+    return;
+  }
+
+  char *temp = (char *)malloc(strlen(name) + 1);
+  strlcpy(temp, name, strlen(name) + 1);
+
+  lock_acquire(&lock_file);
+  struct file *file = filesys_open(temp);
+  if (!file || file->inode->data.is_dir) {
+    f->eax = 0;
+  } else {
+    f->eax = file_truncate(file, length);
+  }
+  file_close(file);
+  lock_release(&lock_file);
+  free(temp);
+}
+
+void sys_ftruncate(struct intr_frame *f) {
+  int fd = get_integer(f->esp, 1);
+  unsigned int length = get_integer(f->esp, 2);
+
+  #ifdef DEBUG
+  printf("[sys_ftruncate] fd: %d, length: %u\n", fd, length);
+  #endif
+
+  if (fd == STDIN_FILENO || fd == STDOUT_FILENO || !process_valid_fd(fd)) {
+    f->eax = 0;
+    return;
+  }
+
+  struct process *p = process_current();
+  if (p->files[fd]->inode->data.is_dir) {
+    f->eax = 0;
+    return;
+  }
+  lock_acquire(&lock_file);
+  f->eax = file_truncate(p->files[fd], length);
+  lock_release(&lock_file);
+}
+
 #endif
 #endif
 
@@ -727,6 +812,12 @@ syscall_handler (struct intr_frame *f) // UNUSED?
     sys_readdir,
     sys_isdir,
     sys_inumber,
+    sys_fallocate,
+    sys_truncate,
+    sys_ftruncate,
+    #endif
+    #ifdef PR_VM
+    sys_fork,
     #endif
   };
 
@@ -1,22 +1,58 @@
 #include "vm/frame.h"
+#include <round.h>
+#include <string.h>
+#include "filesys/file.h"
 #include "threads/malloc.h"
 #include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+#include "vm/swap.h"
 
 struct frame_table frame_table;
 extern struct lock lock_file;
 
-unsigned frame_hash (const struct hash_elem *e, void *aux);
-bool frame_less (const struct hash_elem *a, const struct hash_elem *b, void *aux);
+// the pageout thread is woken when free user frames drop below the low
+// watermark, and evicts until they reach the high watermark
+static size_t low_watermark;
+static size_t high_watermark;
+static struct semaphore pageout_sema;
+static bool pageout_wanted; // pageout thread woken and not done yet, protected by frame_table.lock
+
+static void pageout_thread(void *aux);
+static size_t pageout_batch(void);
+static void frame_evict(struct frame_table_entry *fte);
+static bool frame_is_zero(const uint8_t *frame);
+static void page_io_begin(struct page_table *page_table, struct page_table_entry *pte);
+static void page_io_end(struct page_table *page_table, struct page_table_entry *pte);
+
+static unsigned text_hash(const struct hash_elem *e, void *aux UNUSED) {
+    const struct frame_table_entry *fte = hash_entry(e, struct frame_table_entry, text_elem);
+    return hash_bytes(&fte->inode, sizeof fte->inode) ^ hash_int(fte->offset);
+}
+
+static bool text_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED) {
+    const struct frame_table_entry *fte1 = hash_entry(a, struct frame_table_entry, text_elem);
+    const struct frame_table_entry *fte2 = hash_entry(b, struct frame_table_entry, text_elem);
+    if (fte1->inode != fte2->inode) {
+        return fte1->inode < fte2->inode;
+    }
+    return fte1->offset < fte2->offset;
+}
 
-unsigned frame_hash (const struct hash_elem *e, void *aux) {
-    struct frame_table_entry *fte = hash_entry(e, struct frame_table_entry, hash_elem);
-    return hash_bytes(&fte->frame, sizeof(fte->frame));
+// returns the shared text frame holding the page at OFFSET of executable INODE, or NULL
+static struct frame_table_entry *text_cache_find(struct inode *inode, off_t offset) {
+    struct frame_table_entry key;
+    key.inode = inode;
+    key.offset = offset;
+    struct hash_elem *e = hash_find(&frame_table.text_cache, &key.text_elem);
+    return e != NULL ? hash_entry(e, struct frame_table_entry, text_elem) : NULL;
 }
 
-bool frame_less (const struct hash_elem *a, const struct hash_elem *b, void *aux) {
-    struct frame_table_entry *fte1 = hash_entry(a, struct frame_table_entry, hash_elem);
-    struct frame_table_entry *fte2 = hash_entry(b, struct frame_table_entry, hash_elem);
-    return fte1->frame < fte2->frame;
+// returns the table entry for user frame FRAME, in use or not
+static struct frame_table_entry *frame_table_entry(uint8_t *frame) {
+    size_t idx = (frame - frame_table.base) / PGSIZE;
+    ASSERT(idx < frame_table.size);
+    return &frame_table.entries[idx];
 }
 
 /*
@@ -30,8 +66,136 @@ frame_table_init (void)
     #endif
 
     lock_init(&frame_table.lock);
-    hash_init(&frame_table.hash, frame_hash, frame_less, NULL);
+    cond_init(&frame_table.io_done);
     list_init(&frame_table.list);
+    frame_table.hand = list_end(&frame_table.list);
+    hash_init(&frame_table.text_cache, text_hash, text_less, NULL);
+    // from the kernel pool, so it is never in the table nor evicted
+    frame_table.zero_page = palloc_get_page(PAL_ASSERT | PAL_ZERO);
+
+    // user frames come from one contiguous pool, so the table is a dense
+    // array allocated once and entries never need allocating on a fault
+    size_t user_frames = palloc_page_count(PAL_USER);
+    size_t i;
+    frame_table.base = palloc_pool_base(PAL_USER);
+    frame_table.size = user_frames;
+    frame_table.entries = palloc_get_multiple(PAL_ASSERT | PAL_ZERO,
+                                              DIV_ROUND_UP(user_frames * sizeof *frame_table.entries, PGSIZE));
+    for (i=0; i<user_frames; i++) {
+        frame_table.entries[i].frame = frame_table.base + i * PGSIZE;
+        frame_table.entries[i].in_use = false;
+        frame_table.entries[i].pin_cnt = 0;
+    }
+
+    low_watermark = user_frames / 64 + 1;
+    high_watermark = user_frames / 16 + 2;
+    sema_init(&pageout_sema, 0);
+    pageout_wanted = false;
+    thread_create("pageout", PRI_DEFAULT, pageout_thread, NULL);
+}
+
+/*
+ * Pageout thread: evicts frames ahead of demand, so that page faults
+ * usually find a free frame and do no write-back themselves.  The
+ * frame table lock is dropped after each eviction to let faults in.
+ */
+static void pageout_thread(void *aux UNUSED) {
+    for (;;) {
+        sema_down(&pageout_sema);
+
+        while (palloc_free_count(PAL_USER) < high_watermark) {
+            lock_acquire(&frame_table.lock);
+            size_t freed = pageout_batch();
+            lock_release(&frame_table.lock);
+            if (freed == 0) {
+                // nothing evictable right now
+                break;
+            }
+        }
+
+        lock_acquire(&frame_table.lock);
+        pageout_wanted = false;
+        lock_release(&frame_table.lock);
+    }
+}
+
+/*
+ * Evict and free up to SWAP_CLUSTER frames for the pageout thread.
+ * Dirty private anonymous and ELF pages, the common case under memory
+ * pressure, are collected and written to swap in one batch, to
+ * contiguous slots, unless they are all zeros; other victims are
+ * evicted one by one as usual.
+ * Returns the number of frames freed.  Must be called with
+ * frame_table.lock held, which is released during the batch write.
+ */
+static size_t pageout_batch(void) {
+    struct frame_table_entry *batch[SWAP_CLUSTER];
+    uint8_t *frames[SWAP_CLUSTER];
+    disk_sector_t blocks[SWAP_CLUSTER];
+    size_t cnt = 0, freed = 0, i;
+
+    while (cnt < SWAP_CLUSTER && palloc_free_count(PAL_USER) + cnt < high_watermark
+           && !list_empty(&frame_table.list)) {
+        uint8_t *frame = frame_table_select_victim();
+        if (frame == NULL) {
+            break;
+        }
+        struct frame_table_entry *fte = frame_table_find(frame);
+        uint32_t *pd = fte->owner->thread->pagedir;
+        struct page_table *page_table = &fte->owner->page_table;
+        struct page_table_entry *pte = page_table_find(page_table, fte->page);
+        fte->pin_cnt++;
+
+        // unmap before looking at the dirty bit, so the owner cannot dirty it behind our back
+        pagedir_clear_page(pd, fte->page);
+        if (!list_empty(&fte->sharers) || pte->origin == PAGE_MMAP || !pagedir_is_dirty(pd, fte->page)) {
+            frame_evict(fte);
+            frame_table_remove(frame);
+            palloc_free_page(frame);
+            freed++;
+            continue;
+        }
+        if (frame_is_zero(frame)) {
+            // not worth a swap slot: reads see the zero page until the next write
+            pte->frame = NULL;
+            pte->zero = true;
+            pagedir_set_page(pd, fte->page, frame_table.zero_page, false);
+            frame_table_remove(frame);
+            palloc_free_page(frame);
+            freed++;
+            continue;
+        }
+        page_io_begin(page_table, pte);
+        batch[cnt] = fte;
+        frames[cnt++] = frame;
+    }
+    if (cnt == 0) {
+        return freed;
+    }
+
+    lock_release(&frame_table.lock);
+    swap_out_multiple(frames, cnt, blocks);
+    lock_acquire(&frame_table.lock);
+
+    for (i=0; i<cnt; i++) {
+        struct page_table *page_table = &batch[i]->owner->page_table;
+        struct page_table_entry *pte = page_table_find(page_table, batch[i]->page);
+        pte->block = blocks[i];
+        pte->disk = true;
+        pte->frame = NULL;
+        page_io_end(page_table, pte);
+        frame_table_remove(frames[i]);
+        palloc_free_page(frames[i]);
+    }
+    return freed + cnt;
+}
+
+// wakes the pageout thread if free frames ran low; frame_table.lock must be held
+static void pageout_check(void) {
+    if (!pageout_wanted && palloc_free_count(PAL_USER) < low_watermark) {
+        pageout_wanted = true;
+        sema_up(&pageout_sema);
+    }
 }
 
 void frame_table_insert(struct process *process, uint8_t *frame, uint8_t *page) {
@@ -39,17 +203,18 @@ void frame_table_insert(struct process *process, uint8_t *frame, uint8_t *page)
     printf("[frame_table_insert] pid: %d, frame: %x, page: %x\n", process->pid, frame, page);
     #endif
 
-    struct frame_table_entry *fte = frame_table_find(frame);
-    if (fte == NULL) {
-        fte = (struct frame_table_entry *)malloc(sizeof(struct frame_table_entry));
+    struct frame_table_entry *fte = frame_table_entry(frame);
+    if (!fte->in_use) {
+        fte->in_use = true;
+        // new frames go just behind the hand, so they are examined last
+        list_insert(frame_table.hand, &fte->list_elem);
     }
-    fte->frame = frame;
+    // a reused (evicted) frame keeps its place in the clock
     fte->owner = process;
     fte->page = page;
-
-    // insert to frame table, consider replacement
-    hash_replace(&frame_table.hash, &fte->hash_elem);
-    list_push_back(&frame_table.list, &fte->list_elem);
+    fte->inode = NULL;
+    fte->ref_cnt = 1;
+    list_init(&fte->sharers);
 }
 
 void frame_table_remove(uint8_t *frame) {
@@ -58,10 +223,59 @@ void frame_table_remove(uint8_t *frame) {
     #endif
 
     struct frame_table_entry *fte = frame_table_find(frame);
-    hash_delete(&frame_table.hash, &fte->hash_elem);
+    if (fte == NULL) {
+        return;
+    }
+    if (fte->inode != NULL) {
+        hash_delete(&frame_table.text_cache, &fte->text_elem);
+        fte->inode = NULL;
+    }
+    if (frame_table.hand == &fte->list_elem) {
+        frame_table.hand = list_next(frame_table.hand);
+    }
     list_remove(&fte->list_elem);
+    fte->in_use = false;
+    fte->pin_cnt = 0;
+}
 
-    free(fte);
+/*
+ * Drop PROCESS's mapping of PAGE to FRAME, as its page table entry is
+ * destroyed.  A shared text frame stays with the other processes
+ * mapping it, and is unmapped here so that pagedir_destroy() does not
+ * free it; otherwise the frame leaves the table.
+ * Must be called with frame_table.lock held.
+ */
+void frame_table_release(struct process *process, uint8_t *page, uint8_t *frame) {
+    struct frame_table_entry *fte = frame_table_find(frame);
+    struct frame_share *share = NULL;
+    struct list_elem *e;
+
+    if (fte == NULL) {
+        return;
+    }
+    if (fte->ref_cnt == 1) {
+        frame_table_remove(frame);
+        return;
+    }
+
+    pagedir_clear_page(process->thread->pagedir, page);
+    fte->ref_cnt--;
+    if (fte->owner == process && fte->page == page) {
+        // hand the frame to one of the sharers
+        share = list_entry(list_pop_front(&fte->sharers), struct frame_share, elem);
+        fte->owner = share->owner;
+        fte->page = share->page;
+    } else {
+        for (e = list_begin(&fte->sharers); e != list_end(&fte->sharers); e = list_next(e)) {
+            share = list_entry(e, struct frame_share, elem);
+            if (share->owner == process && share->page == page) {
+                list_remove(e);
+                break;
+            }
+        }
+        ASSERT(e != list_end(&fte->sharers));
+    }
+    free(share);
 }
 
 struct frame_table_entry *frame_table_find(uint8_t *frame) {
@@ -69,56 +283,268 @@ struct frame_table_entry *frame_table_find(uint8_t *frame) {
     printf("[frame_table_find] frame: %x\n", frame);
     #endif
 
-    struct frame_table_entry fte;
-    fte.frame = frame;
-    struct hash_elem *e = hash_find(&frame_table.hash, &fte.hash_elem);
-    if (e == NULL) {
+    if (frame < frame_table.base || frame >= frame_table.base + frame_table.size * PGSIZE) {
         return NULL;
     }
-    return hash_entry(e, struct frame_table_entry, hash_elem);
+    struct frame_table_entry *fte = frame_table_entry(frame);
+    return fte->in_use ? fte : NULL;
 }
 
-uint8_t *frame_table_select_victim() {
-    // get page table entry according to owener and page
+// clears the accessed bit of every mapping of FTE; returns whether any was set
+static bool frame_test_and_clear_accessed(struct frame_table_entry *fte) {
+    uint32_t *pd = fte->owner->thread->pagedir;
+    bool accessed = pagedir_is_accessed(pd, fte->page);
+    struct list_elem *e;
+
+    pagedir_set_accessed(pd, fte->page, false);
+    for (e = list_begin(&fte->sharers); e != list_end(&fte->sharers); e = list_next(e)) {
+        struct frame_share *share = list_entry(e, struct frame_share, elem);
+        pd = share->owner->thread->pagedir;
+        accessed = accessed || pagedir_is_accessed(pd, share->page);
+        pagedir_set_accessed(pd, share->page, false);
+    }
+    return accessed;
+}
 
-    /*
-    // WARNING: current implementation returns the first hash element
-    struct hash_iterator i;
-    hash_first(&i, &frame_table.hash);
-    hash_next(&i);
-    struct frame_table_entry *fte = hash_entry(hash_cur(&i), struct frame_table_entry, hash_elem);
-    uint8_t *frame = fte->frame;
-    */
+// returns the frame under the clock hand and advances the hand, wrapping around
+static struct frame_table_entry *clock_advance(void) {
+    if (frame_table.hand == list_end(&frame_table.list)) {
+        frame_table.hand = list_begin(&frame_table.list);
+    }
+    struct frame_table_entry *fte = list_entry(frame_table.hand, struct frame_table_entry, list_elem);
+    frame_table.hand = list_next(frame_table.hand);
+    return fte;
+}
 
-    // WARNING: FIFO
-    struct list_elem *e = list_pop_front(&frame_table.list);
-    struct frame_table_entry *fte = list_entry(e, struct frame_table_entry, list_elem);
-    uint8_t *frame = fte->frame;
-    list_push_back(&frame_table.list, e);
+/*
+ * Select a frame to evict with the enhanced second-chance (clock)
+ * algorithm, using the accessed and dirty bits of the frame's pages.
+ * The first sweep takes the first frame neither accessed nor dirty,
+ * clearing accessed bits as it goes; failing that, the first frame
+ * that was dirty but not accessed, since writing it out is cheaper
+ * than losing the working set.  If every frame had been accessed,
+ * a second sweep (with all accessed bits now clear) prefers a clean
+ * frame.  Pinned frames are skipped; returns NULL if every frame is
+ * pinned.  Must be called with frame_table.lock held.
+ */
+uint8_t *frame_table_select_victim(void) {
+    struct frame_table_entry *fte;
+    struct frame_table_entry *dirty_victim = NULL;
+    struct frame_table_entry *any_victim = NULL;
+    size_t cnt = list_size(&frame_table.list);
+    size_t i;
+
+    ASSERT(cnt > 0);
+
+    // first sweep
+    for (i=0; i<cnt; i++) {
+        fte = clock_advance();
+        if (fte->pin_cnt > 0) {
+            continue;
+        }
+        if (frame_test_and_clear_accessed(fte)) {
+            // second chance
+        } else if (!pagedir_is_dirty(fte->owner->thread->pagedir, fte->page)) {
+            goto done;
+        } else if (dirty_victim == NULL) {
+            dirty_victim = fte;
+        }
+    }
+    if (dirty_victim != NULL) {
+        fte = dirty_victim;
+        goto done;
+    }
 
-    /*
-    struct list_elem *e;
-    uint8_t *frame = list_back(&frame_table.list);
-    for (e=list_begin(&frame_table.list); e!=list_end(&frame_table.list); e=list_next(e)) {
-      struct frame_table_entry *fte = list_entry(e, struct frame_table_entry, list_elem);
-      if (!(pagedir_is_dirty(fte->owner->thread->pagedir, fte->page) ||
-        pagedir_is_accessed(fte->owner->thread->pagedir, fte->page))) {
-          frame = fte->frame;
-          break;
-      }
+    // second sweep: every frame was accessed
+    for (i=0; i<cnt; i++) {
+        fte = clock_advance();
+        if (fte->pin_cnt > 0) {
+            continue;
+        }
+        if (!pagedir_is_dirty(fte->owner->thread->pagedir, fte->page)) {
+            goto done;
+        }
+        if (any_victim == NULL) {
+            any_victim = fte;
+        }
     }
-    */
+    if (any_victim == NULL) {
+        return NULL;
+    }
+    fte = any_victim;
 
+done:
     #ifdef DEBUG
-    printf("[frame_table_select_victim] victim: %x\n", frame);
+    printf("[frame_table_select_victim] victim: %x\n", fte->frame);
     #endif
 
+    return fte->frame;
+}
+
+// acquires lock_file unless the current thread already holds it (e.g. during load); returns whether it did
+static bool file_lock_acquire(void) {
+    if (lock_held_by_current_thread(&lock_file)) {
+        return false;
+    }
+    lock_acquire(&lock_file);
+    return true;
+}
+
+// marks PTE of PAGE_TABLE busy while its I/O runs without frame_table.lock
+static void page_io_begin(struct page_table *page_table, struct page_table_entry *pte) {
+    ASSERT(!pte->busy);
+    pte->busy = true;
+    page_table->busy_cnt++;
+}
+
+// ends the I/O begun by page_io_begin() and wakes anyone waiting for it
+static void page_io_end(struct page_table *page_table, struct page_table_entry *pte) {
+    ASSERT(pte->busy);
+    pte->busy = false;
+    page_table->busy_cnt--;
+    cond_broadcast(&frame_table.io_done, &frame_table.lock);
+}
+
+/*
+ * Unmap the page in FTE, which must be pinned, from every process
+ * mapping it and save its contents if they cannot be recovered
+ * otherwise.  Dirty mmap pages are written back to their file; other
+ * dirty pages go to swap, one copy per process if the frame was shared
+ * by fork.  Dirty pages of all zeros are not written anywhere: they
+ * are mapped to the shared zero page instead.  Clean pages are dropped:
+ * they are read back from their ELF or mapped file, or zero-filled if
+ * anonymous, on the next fault.
+ * Called with frame_table.lock held; the lock is released during the
+ * writes, while the entries are busy, so that other page faults are
+ * not held up by the disk.
+ */
+static void frame_evict(struct frame_table_entry *fte) {
+    struct frame_share owner; // the owner, as one more mapping
+    struct list_elem *e;
+    bool dirty = false;
+    bool zero = false;
+
+    ASSERT(fte->pin_cnt > 0);
+    ASSERT(page_table_find(&fte->owner->page_table, fte->page)->frame == fte->frame);
+
+    owner.owner = fte->owner;
+    owner.page = fte->page;
+    list_push_front(&fte->sharers, &owner.elem);
+
+    // unmap first, so that no process writes (or faults and waits) while we copy out;
+    // the entries are found now, as the page tables must not be searched without the lock
+    for (e = list_begin(&fte->sharers); e != list_end(&fte->sharers); e = list_next(e)) {
+        struct frame_share *share = list_entry(e, struct frame_share, elem);
+        uint32_t *pd = share->owner->thread->pagedir;
+        share->pte = page_table_find(&share->owner->page_table, share->page);
+        dirty = dirty || pagedir_is_dirty(pd, share->page);
+        pagedir_clear_page(pd, share->page);
+    }
+    if (fte->inode != NULL) {
+        // shared text is read-only, hence never dirty
+        hash_delete(&frame_table.text_cache, &fte->text_elem);
+        fte->inode = NULL;
+    }
+    // mmap pages are not shared, so the owner's origin is everyone's
+    if (dirty && owner.pte->origin != PAGE_MMAP && frame_is_zero(fte->frame)) {
+        zero = true;
+        dirty = false;
+    }
+
+    if (dirty) {
+        for (e = list_begin(&fte->sharers); e != list_end(&fte->sharers); e = list_next(e)) {
+            struct frame_share *share = list_entry(e, struct frame_share, elem);
+            page_io_begin(&share->owner->page_table, share->pte);
+        }
+        lock_release(&frame_table.lock);
+        for (e = list_begin(&fte->sharers); e != list_end(&fte->sharers); e = list_next(e)) {
+            struct frame_share *share = list_entry(e, struct frame_share, elem);
+            // busy: nobody else touches the entry until page_io_end()
+            struct page_table_entry *pte = share->pte;
+            if (pte->origin == PAGE_MMAP) {
+                bool locked = file_lock_acquire();
+                // don't extend the file with the zeros past its end
+                off_t bytes = file_length(pte->file) - pte->offset;
+                file_write_at(pte->file, fte->frame, bytes < PGSIZE ? bytes : PGSIZE, pte->offset);
+                if (locked) {
+                    lock_release(&lock_file);
+                }
+            } else {
+                // swap out, what if disk full?
+                pte->block = swap_out(fte->frame);
+            }
+        }
+        lock_acquire(&frame_table.lock);
+    }
+
+    while (!list_empty(&fte->sharers)) {
+        struct frame_share *share = list_entry(list_pop_front(&fte->sharers), struct frame_share, elem);
+        struct page_table *page_table = &share->owner->page_table;
+        struct page_table_entry *pte = share->pte;
+        pte->frame = NULL;
+        if (zero) {
+            pte->zero = true;
+            pagedir_set_page(share->owner->thread->pagedir, share->page, frame_table.zero_page, false);
+        }
+        if (dirty) {
+            if (pte->origin != PAGE_MMAP) {
+                pte->disk = true;
+            }
+            page_io_end(page_table, pte);
+        }
+        if (share != &owner) {
+            free(share);
+        }
+    }
+    fte->ref_cnt = 1;
+}
+
+// whether FRAME holds only zeros, e.g. a stack or BSS page that was written but never used
+static bool frame_is_zero(const uint8_t *frame) {
+    const uint32_t *word = (const uint32_t *) frame;
+    size_t i;
+    for (i=0; i<PGSIZE / sizeof *word; i++) {
+        if (word[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Returns a free user frame, entered in the frame table for PAGE of
+ * the current process and pinned.  Normally the pageout thread keeps
+ * some in reserve; if it has fallen behind, a victim is evicted right
+ * here, waiting for pinned frames to be released if need be.
+ * Must be called with frame_table.lock held, which may be released
+ * and reacquired meanwhile.
+ */
+static uint8_t *frame_get(enum palloc_flags flag, uint8_t *page) {
+    uint8_t *frame = palloc_get_page(PAL_USER | flag);
+
+    pageout_check();
+    if (frame == NULL) {
+        while ((frame = frame_table_select_victim()) == NULL) {
+            cond_wait(&frame_table.io_done, &frame_table.lock);
+        }
+        struct frame_table_entry *fte = frame_table_find(frame);
+        fte->pin_cnt++;
+        frame_evict(fte);
+        if (flag & PAL_ZERO) {
+            memset(frame, 0, PGSIZE);
+        }
+    }
+    frame_table_insert(process_current(), frame, page);
+    // a new frame, or the victim pinned above: either way pinned once, for the caller
+    frame_table_find(frame)->pin_cnt = 1;
     return frame;
 }
 
 /*
  * Make a new frame table entry for addr.
  * allocate_frame does not call palloc_get_page.
+ * The frame is returned pinned, so that the caller can fill it through
+ * its kernel address; call frame_unpin() when done.
  */
 uint8_t *
 allocate_frame (uint8_t *page, bool writable, enum palloc_flags flag)
@@ -129,51 +555,341 @@ allocate_frame (uint8_t *page, bool writable, enum palloc_flags flag)
 
   // prevent concurrent table modifications
   lock_acquire(&frame_table.lock);
-  uint8_t *frame = palloc_get_page(PAL_USER | flag);
+  uint8_t *frame = frame_get(flag, page);
+
+  // fill in pte, counted as referenced so that it is not evicted before first use
+  pagedir_clear_page(thread_current()->pagedir, page);
+  pagedir_set_page(thread_current()->pagedir, page, frame, writable);
+  pagedir_set_accessed(thread_current()->pagedir, page, true);
+
+  // update page table for current process
+  page_table_insert_frame(&process_current()->page_table, page, frame);
+  page_table_find(&process_current()->page_table, page)->writable = writable;
+  lock_release(&frame_table.lock);
+
+  return frame;
+}
+
+/*
+ * Make FRAME, pinned by allocate_frame(), evictable again.
+ */
+void
+frame_unpin (uint8_t *frame)
+{
+  lock_acquire(&frame_table.lock);
+  struct frame_table_entry *fte = frame_table_find(frame);
+  if (fte != NULL) {
+    ASSERT(fte->pin_cnt > 0);
+    fte->pin_cnt--;
+    cond_broadcast(&frame_table.io_done, &frame_table.lock);
+  }
+  lock_release(&frame_table.lock);
+}
+
+/*
+ * Bring PAGE of the current process back into memory from swap, from
+ * its ELF or mapped file, or as zeros, according to its page table
+ * entry.  If the page is still being written out, waits for that
+ * first.  The read runs without frame_table.lock, with the entry busy
+ * and the frame pinned, so faults in other processes go on meanwhile.
+ * Read-only text is mapped from the frame of another process running
+ * the same executable when there is one, and otherwise becomes such a
+ * frame once read.  A page of zeros (stack, BSS) is mapped to the
+ * shared zero page on a read, and gets a frame only when WRITE is true
+ * or on the first write afterwards.  Returns false if PAGE has no entry.
+ */
+bool
+frame_page_in (uint8_t *page, bool write)
+{
+  struct process *p = process_current();
+  bool dirty = false;
+  struct inode *text = NULL;
+  uint8_t *frame;
+
+  lock_acquire(&frame_table.lock);
+  struct page_table_entry *pte = page_table_lookup(&p->page_table, page);
+  while (pte != NULL && pte->busy) {
+    cond_wait(&frame_table.io_done, &frame_table.lock);
+    pte = page_table_lookup(&p->page_table, page);
+  }
+  if (pte == NULL || pte->frame != NULL) {
+    lock_release(&frame_table.lock);
+    return pte != NULL;
+  }
+  if (pte->zero) {
+    lock_release(&frame_table.lock);
+    return !write || frame_cow_fault(page);
+  }
 
-  if (frame == NULL) {
-    // select victim frame
-    frame = frame_table_select_victim();
+  if (!write && !pte->disk && (pte->origin == PAGE_ANON || (pte->origin == PAGE_ELF && pte->read_bytes == 0))) {
+    pte->zero = true;
+    pagedir_set_page(p->thread->pagedir, page, frame_table.zero_page, false);
+    lock_release(&frame_table.lock);
+    return true;
+  }
 
-    // fill in pte
-    pagedir_clear_page(thread_current()->pagedir, page);
-    pagedir_set_page(thread_current()->pagedir, page, frame, writable);
+  if (!pte->disk && pte->origin == PAGE_ELF && !pte->writable) {
+    text = file_get_inode(pte->file);
+    struct frame_table_entry *fte = text_cache_find(text, pte->offset);
+    if (fte != NULL && fte->read_bytes == pte->read_bytes) {
+      struct frame_share *share = malloc(sizeof *share);
+      ASSERT(share != NULL);
+      share->owner = p;
+      share->page = page;
+      list_push_back(&fte->sharers, &share->elem);
+      fte->ref_cnt++;
+      pte->frame = fte->frame;
+      pagedir_set_page(p->thread->pagedir, page, fte->frame, false);
+      pagedir_set_accessed(p->thread->pagedir, page, true);
+      lock_release(&frame_table.lock);
+      return true;
+    }
+  }
 
-    struct frame_table_entry *vfte = frame_table_find(frame);
-    struct page_table_entry *vpte = page_table_find(&vfte->owner->page_table, vfte->page);
+  page_io_begin(&p->page_table, pte);
+  frame = frame_get(pte->disk || pte->origin != PAGE_ANON ? 0 : PAL_ZERO, page);
+  lock_release(&frame_table.lock);
 
-    // victim frame mapped to file
-    if (vpte->file) {
-      // file out
-      lock_acquire(&lock_file);
-      file_write_at(vpte->file, vpte->frame, PGSIZE, vpte->offset);
+  if (pte->disk) {
+    swap_in(pte->block, frame);
+    // the swap slot is released, so the page must be written out again if evicted
+    dirty = true;
+  } else if (pte->origin != PAGE_ANON) {
+    bool locked = file_lock_acquire();
+    off_t n = file_read_at(pte->file, frame, pte->read_bytes, pte->offset);
+    if (locked) {
       lock_release(&lock_file);
+    }
+    memset(frame + n, 0, PGSIZE - n);
+  }
+  // else: clean anonymous page that was dropped, frame_get() zeroed it
+
+  lock_acquire(&frame_table.lock);
+  pte->disk = false;
+  pte->frame = frame;
+  pagedir_set_page(p->thread->pagedir, page, frame, pte->writable);
+  pagedir_set_accessed(p->thread->pagedir, page, true);
+  if (dirty) {
+    pagedir_set_dirty(p->thread->pagedir, page, true);
+  }
+  struct frame_table_entry *fte = frame_table_find(frame);
+  if (text != NULL && text_cache_find(text, pte->offset) == NULL) {
+    // first copy in memory: let other processes running the binary map it
+    fte->inode = text;
+    fte->offset = pte->offset;
+    fte->read_bytes = pte->read_bytes;
+    hash_insert(&frame_table.text_cache, &fte->text_elem);
+  }
+  fte->pin_cnt--;
+  page_io_end(&p->page_table, pte);
+  lock_release(&frame_table.lock);
+  return true;
+}
+
+/*
+ * Wait until no page of PROCESS is being paged in or written out, so
+ * that its page table entries can be freed or unmapped.  Must be
+ * called with frame_table.lock held.
+ */
+void
+frame_wait_idle (struct process *process)
+{
+  while (process->page_table.busy_cnt > 0) {
+    cond_wait(&frame_table.io_done, &frame_table.lock);
+  }
+}
 
-      // update page table for file out page(process)
-      page_table_insert_file(&vfte->owner->page_table, vfte->page, vpte->file, vpte->offset);
+/*
+ * Handle a write to PAGE of the current process, which is mapped
+ * read-only.  If the page is writable but its frame is shared with a
+ * forked process, the current process gets a private copy; if it is
+ * the last process using the frame, the frame is just made writable.
+ * A page on the shared zero page gets a zeroed frame of its own.
+ * Returns false if the page is really read-only.
+ */
+bool
+frame_cow_fault (uint8_t *page)
+{
+  struct process *p = process_current();
+  uint32_t *pd = p->thread->pagedir;
+
+  lock_acquire(&frame_table.lock);
+  struct page_table_entry *pte = page_table_find(&p->page_table, page);
+  while (pte != NULL && pte->busy) {
+    cond_wait(&frame_table.io_done, &frame_table.lock);
+    pte = page_table_find(&p->page_table, page);
+  }
+  if (pte == NULL || !pte->writable) {
+    lock_release(&frame_table.lock);
+    return false;
+  }
+  if (pte->zero) {
+    page_io_begin(&p->page_table, pte);
+    pagedir_clear_page(pd, page);
+    pte->zero = false;
+    uint8_t *frame = frame_get(PAL_ZERO, page);
+    pte->frame = frame;
+    pagedir_set_page(pd, page, frame, true);
+    pagedir_set_accessed(pd, page, true);
+    frame_table_find(frame)->pin_cnt--;
+    page_io_end(&p->page_table, pte);
+    lock_release(&frame_table.lock);
+    return true;
+  }
+  if (pte->frame == NULL) {
+    // evicted meanwhile; it comes back private and writable
+    lock_release(&frame_table.lock);
+    return frame_page_in(page, true);
+  }
+
+  struct frame_table_entry *shared = frame_table_find(pte->frame);
+  if (shared->ref_cnt > 1) {
+    // frame_get() may drop the lock: the entry is busy so that nobody
+    // else touches it, and the shared frame pinned so that it stays put;
+    // the other sharers may be copying it too, hence a count
+    page_io_begin(&p->page_table, pte);
+    shared->pin_cnt++;
+    uint8_t *frame = frame_get(0, page);
+    shared->pin_cnt--;
+
+    if (shared->ref_cnt > 1) {
+      memcpy(frame, shared->frame, PGSIZE);
+      frame_table_release(p, page, shared->frame);
+      pte->frame = frame;
+      pagedir_set_page(pd, page, frame, true);
+      pagedir_set_accessed(pd, page, true);
+      // the copy differs from the page's file or swap contents
+      pagedir_set_dirty(pd, page, true);
+      frame_table_find(frame)->pin_cnt--;
     } else {
-        // swap out, what if disk full?
-        disk_sector_t block = swap_out(frame);
+      // the other processes let go of the frame meanwhile: it is ours alone
+      frame_table_remove(frame);
+      palloc_free_page(frame);
+      pagedir_set_writable(pd, page, true);
+    }
+    page_io_end(&p->page_table, pte);
+  } else {
+    pagedir_set_writable(pd, page, true);
+  }
+  lock_release(&frame_table.lock);
+  return true;
+}
+
+/*
+ * Give CHILD, the current process, a copy-on-write copy of PARENT's
+ * address space: resident pages share PARENT's frames, mapped read-only
+ * in both until one of them writes; swapped pages get a copy of their
+ * swap slot; the rest are read from their file or zeroed on first
+ * touch, as in PARENT.  Memory mappings are not inherited.
+ * The swap slots are copied without frame_table.lock, while CHILD's
+ * entries for them are busy.
+ * Returns false if out of memory or swap.
+ */
+bool
+frame_table_fork (struct process *parent, struct process *child)
+{
+  uint32_t *parent_pd = parent->thread->pagedir;
+  uint32_t *child_pd = child->thread->pagedir;
+  struct page_table_entry **swapped = NULL;
+  size_t swap_cnt = 0, k;
+  struct hash_iterator i;
+  struct list_elem *e;
+  bool success = true;
+
+  lock_acquire(&frame_table.lock);
+  frame_wait_idle(parent);
+
+  // the lock is held until the slots are copied, so the count stays right
+  hash_first(&i, &parent->page_table.hash);
+  while (hash_next(&i)) {
+    struct page_table_entry *src = hash_entry(hash_cur(&i), struct page_table_entry, hash_elem);
+    if (src->origin != PAGE_MMAP && src->disk) {
+      swap_cnt++;
+    }
+  }
+  if (swap_cnt > 0) {
+    swapped = malloc(swap_cnt * sizeof *swapped);
+    if (swapped == NULL) {
+      lock_release(&frame_table.lock);
+      return false;
+    }
+    swap_cnt = 0;
+  }
 
-        // update page table for swapped out page(process)
-        page_table_insert_block(&vfte->owner->page_table, vfte->page, block);
+  for (e = list_begin(&parent->page_table.vmas); e != list_end(&parent->page_table.vmas); e = list_next(e)) {
+    struct vma *vma = list_entry(e, struct vma, elem);
+    if (vma->origin == PAGE_MMAP) {
+      continue;
+    }
+    if (!page_table_insert_vma(&child->page_table, vma->start, (vma->end - vma->start) / PGSIZE, vma->origin,
+                               child->exec, vma->offset, vma->read_bytes, vma->writable)) {
+      lock_release(&frame_table.lock);
+      free(swapped);
+      return false;
     }
+  }
 
-    pagedir_clear_page(vfte->owner->thread->pagedir, vfte->page); // clear page
+  hash_first(&i, &parent->page_table.hash);
+  while (success && hash_next(&i)) {
+    struct page_table_entry *src = hash_entry(hash_cur(&i), struct page_table_entry, hash_elem);
+    if (src->origin == PAGE_MMAP) {
+      continue;
+    }
 
-    // update frame table and page table for current process
-    frame_table_insert(process_current(), frame, page);
-    page_table_insert_frame(&process_current()->page_table, page, frame);
-  } else {
-    // fill in pte
-    pagedir_clear_page(thread_current()->pagedir, page);
-    pagedir_set_page(thread_current()->pagedir, page, frame, writable);
+    struct page_table_entry *pte = page_table_insert_copy(&child->page_table, src);
+    if (pte == NULL) {
+      success = false;
+      break;
+    }
+    if (pte->origin == PAGE_ELF) {
+      pte->file = child->exec;
+    }
 
-    // update frame table and page table for current process
-    frame_table_insert(process_current(), frame, page);
-    page_table_insert_frame(&process_current()->page_table, page, frame);
+    if (src->frame != NULL) {
+      struct frame_table_entry *fte = frame_table_find(src->frame);
+      struct frame_share *share = malloc(sizeof *share);
+      if (share == NULL || !pagedir_set_page(child_pd, src->page, src->frame, false)) {
+        free(share);
+        success = false;
+        break;
+      }
+      share->owner = child;
+      share->page = src->page;
+      list_push_back(&fte->sharers, &share->elem);
+      fte->ref_cnt++;
+      pte->frame = src->frame;
+
+      // both see the page as modified if it was, for eviction
+      pagedir_set_dirty(child_pd, src->page, pagedir_is_dirty(parent_pd, src->page));
+      pagedir_set_accessed(child_pd, src->page, true);
+      pagedir_set_writable(parent_pd, src->page, false);
+    } else if (src->zero) {
+      if (!pagedir_set_page(child_pd, src->page, frame_table.zero_page, false)) {
+        success = false;
+        break;
+      }
+      pte->zero = true;
+    } else if (src->disk) {
+      // copied below; until then the entry does not own the parent's slot
+      pte->disk = false;
+      page_io_begin(&child->page_table, pte);
+      swapped[swap_cnt++] = pte;
+    }
   }
   lock_release(&frame_table.lock);
 
-  return frame;
+  // the parent's slots stay put: it is blocked in fork()
+  for (k=0; success && k<swap_cnt; k++) {
+    struct page_table_entry *pte = swapped[k];
+    pte->disk = swap_copy(pte->block, &pte->block);
+    success = pte->disk;
+  }
+
+  lock_acquire(&frame_table.lock);
+  for (k=0; k<swap_cnt; k++) {
+    page_io_end(&child->page_table, swapped[k]);
+  }
+  lock_release(&frame_table.lock);
+  free(swapped);
+  return success;
 }
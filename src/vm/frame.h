@@ -5,29 +5,59 @@
 #include <hash.h>
 #include "userprog/process.h"
 #include "threads/palloc.h"
+#include "filesys/off_t.h"
+
+// a process other than the owner mapping a shared text or copy-on-write frame
+struct frame_share {
+	struct process *owner;
+	uint8_t *page;
+	struct page_table_entry *pte; // owner's entry for page, set by frame_evict() under frame_table.lock
+	struct list_elem elem;
+};
 
 struct frame_table_entry
 {
 	uint8_t *frame;
 	struct process* owner;
 	uint8_t *page;
+	bool in_use; // frame holds a user page
+	int pin_cnt; // nonzero while the frame is being filled, written back or used by the kernel; never evicted then
+
+	// read-only executable text is mapped from one frame into every process running the binary
+	struct inode *inode; // executable the text came from, NULL if the frame is private
+	off_t offset;
+	uint32_t read_bytes;
+	int ref_cnt; // mappings: the owner plus sharers; private frames shared by fork are copy-on-write
+	struct list sharers; // struct frame_share
 
-	struct hash_elem hash_elem;
 	struct list_elem list_elem;
+	struct hash_elem text_elem; // in frame_table.text_cache
 };
 
 struct frame_table {
-	struct hash hash;
-	struct list list;
+	struct frame_table_entry *entries; // one per user pool frame, indexed by (frame - base) / PGSIZE
+	uint8_t *base; // first frame of the user pool
+	size_t size; // number of entries
+	struct list list; // frames in use, in clock order
+	struct list_elem *hand; // clock hand: next frame to examine for eviction
 	struct lock lock;
+	struct condition io_done; // signaled when page I/O finishes or a frame is unpinned
+	struct hash text_cache; // shared text frames by inode and offset
+	uint8_t *zero_page; // kernel page of zeros, mapped read-only for pages only read so far
 };
 
 void frame_table_init (void);
 
-uint8_t *frame_table_select_victim();
+uint8_t *frame_table_select_victim(void);
 void frame_table_insert(struct process *process, uint8_t *frame, uint8_t *page);
 void frame_table_remove(uint8_t *frame);
+void frame_table_release(struct process *process, uint8_t *page, uint8_t *frame);
 struct frame_table_entry *frame_table_find(uint8_t *frame);
 
 uint8_t *allocate_frame (uint8_t *page, bool writable, enum palloc_flags flag);
+void frame_unpin (uint8_t *frame);
+bool frame_page_in (uint8_t *page, bool write);
+void frame_wait_idle (struct process *process);
+bool frame_cow_fault (uint8_t *page);
+bool frame_table_fork (struct process *parent, struct process *child);
 #endif /* vm/frame.h */
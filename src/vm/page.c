@@ -1,13 +1,12 @@
 #include <bitmap.h>
 #include "threads/malloc.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
 #include "userprog/process.h"
 #include "vm/page.h"
 #include "vm/frame.h"
 #include "vm/swap.h"
 
-extern int block_size;
-extern struct bitmap *swap_table;
-extern struct lock swap_lock;
 extern struct frame_table frame_table;
 extern struct lock lock_file;
 
@@ -25,6 +24,30 @@ bool page_less (const struct hash_elem *a, const struct hash_elem *b, void *aux)
     return pte1->page < pte2->page;
 }
 
+// returns a new entry for an anonymous, writable page that is not in memory, or NULL if out of memory
+static struct page_table_entry *page_table_entry_create(void) {
+    struct page_table_entry *pte = (struct page_table_entry *)malloc(sizeof(struct page_table_entry));
+    if (pte == NULL) {
+        return NULL;
+    }
+    pte->frame = NULL;
+    pte->block = 0;
+    pte->disk = false;
+    pte->file = NULL;
+    pte->offset = 0;
+    pte->read_bytes = 0;
+    pte->origin = PAGE_ANON;
+    pte->writable = true;
+    pte->busy = false;
+    pte->zero = false;
+    return pte;
+}
+
+// links PTE to the entries of VMA, the region containing its page, or of no region if NULL
+static void page_table_attach(struct page_table *page_table, struct page_table_entry *pte, struct vma *vma) {
+    list_push_back(vma != NULL ? &vma->pages : &page_table->loose, &pte->vma_elem);
+}
+
 /*
  * Initialize supplementary page table
  */
@@ -35,29 +58,25 @@ void page_table_init(struct page_table *page_table)
     #endif
 
     hash_init(&page_table->hash, page_hash, page_less, NULL);
+    list_init(&page_table->vmas);
+    list_init(&page_table->loose);
+    page_table->busy_cnt = 0;
 }
 
-void page_table_insert_file(struct page_table *page_table, uint8_t *page, struct file *file, off_t offset) {
-  #ifdef DEBUG
-  printf("[page_table_insert_file] page: %x, offset: %u\n", page, offset);
-  #endif
-
-  struct page_table_entry *pte = page_table_find(page_table, page);
-  if (pte == NULL) {
-      pte = (struct page_table_entry *)malloc(sizeof(struct page_table_entry));
-      pte->frame = NULL;
-      pte->disk = false;
-      pte->file = NULL;
-  }
-  pte->page = page;
-  pte->frame = NULL;
-  pte->block = 0;
-  pte->disk = false;
-  pte->file = file;
-  pte->offset = offset;
+/*
+ * Record PAGE as a new anonymous page (stack growth), not in memory
+ * yet.  It reads as zeros until written.
+ */
+void page_table_insert_anon(struct page_table *page_table, uint8_t *page) {
+    #ifdef DEBUG
+    printf("[page_table_insert_anon] page: %x\n", page);
+    #endif
 
-  // insert to page table, consider replacement
-  hash_replace(&page_table->hash, &pte->hash_elem);
+    struct page_table_entry *pte = page_table_entry_create();
+    ASSERT(pte != NULL);
+    pte->page = page;
+    page_table_attach(page_table, pte, NULL);
+    hash_replace(&page_table->hash, &pte->hash_elem);
 }
 
 void page_table_insert_block(struct page_table *page_table, uint8_t *page, disk_sector_t block) {
@@ -67,10 +86,10 @@ void page_table_insert_block(struct page_table *page_table, uint8_t *page, disk_
 
     struct page_table_entry *pte = page_table_find(page_table, page);
     if (pte == NULL) {
-        pte = (struct page_table_entry *)malloc(sizeof(struct page_table_entry));
-        pte->frame = NULL;
-        pte->disk = false;
-        pte->file = NULL;
+        pte = page_table_entry_create();
+        ASSERT(pte != NULL);
+        pte->page = page;
+        page_table_attach(page_table, pte, page_table_find_vma(page_table, page));
     }
     pte->page = page;
     pte->frame = NULL;
@@ -88,10 +107,10 @@ void page_table_insert_frame(struct page_table *page_table, uint8_t *page, uint8
 
     struct page_table_entry *pte = page_table_find(page_table, page);
     if (pte == NULL) {
-        pte = (struct page_table_entry *)malloc(sizeof(struct page_table_entry));
-        pte->frame = NULL;
-        pte->disk = false;
-        pte->file = NULL;
+        pte = page_table_entry_create();
+        ASSERT(pte != NULL);
+        pte->page = page;
+        page_table_attach(page_table, pte, page_table_find_vma(page_table, page));
     }
     pte->page = page;
     pte->frame = frame;
@@ -102,6 +121,118 @@ void page_table_insert_frame(struct page_table *page_table, uint8_t *page, uint8
     hash_replace(&page_table->hash, &pte->hash_elem);
 }
 
+/*
+ * Insert a copy of SRC, from another process's page table, that is not
+ * in memory.  Used by fork, after the regions are copied.  Returns the
+ * new entry, or NULL if out of memory.
+ */
+struct page_table_entry *page_table_insert_copy(struct page_table *page_table, const struct page_table_entry *src) {
+    #ifdef DEBUG
+    printf("[page_table_insert_copy] page: %x\n", src->page);
+    #endif
+
+    struct page_table_entry *pte = page_table_entry_create();
+    if (pte == NULL) {
+        return NULL;
+    }
+    pte->page = src->page;
+    pte->block = src->block;
+    pte->disk = src->disk;
+    pte->file = src->file;
+    pte->offset = src->offset;
+    pte->read_bytes = src->read_bytes;
+    pte->origin = src->origin;
+    pte->writable = src->writable;
+
+    page_table_attach(page_table, pte, page_table_find_vma(page_table, pte->page));
+    hash_replace(&page_table->hash, &pte->hash_elem);
+    return pte;
+}
+
+/*
+ * Map the PAGE_CNT pages from START to READ_BYTES bytes of FILE at
+ * OFFSET, followed by zeros, as one region.  No entries are made for
+ * the pages: each is read from FILE when first touched, so the cost
+ * does not depend on the size of the region; nor does the overlap
+ * check, which looks at the other regions and the stack pages only.
+ * Returns false if the region is not in user memory or overlaps pages
+ * already mapped.
+ */
+bool page_table_insert_vma(struct page_table *page_table, uint8_t *start, size_t page_cnt, enum page_origin origin,
+                           struct file *file, off_t offset, uint32_t read_bytes, bool writable) {
+    #ifdef DEBUG
+    printf("[page_table_insert_vma] start: %x, page_cnt: %u\n", start, page_cnt);
+    #endif
+
+    uint8_t *end = start + page_cnt * PGSIZE;
+    struct list_elem *e;
+
+    ASSERT(pg_ofs(start) == 0);
+    if (page_cnt == 0 || end <= start || !is_user_vaddr(end - 1)) {
+        return false;
+    }
+
+    // overlapping regions, then pages outside any region (stack); the
+    // pages of other regions cannot overlap if the regions don't
+    struct list_elem *l;
+    for (l = list_begin(&page_table->loose); l != list_end(&page_table->loose); l = list_next(l)) {
+        struct page_table_entry *pte = list_entry(l, struct page_table_entry, vma_elem);
+        if (pte->page >= start && pte->page < end) {
+            return false;
+        }
+    }
+    for (e = list_begin(&page_table->vmas); e != list_end(&page_table->vmas); e = list_next(e)) {
+        struct vma *vma = list_entry(e, struct vma, elem);
+        if (vma->start >= end) {
+            break;
+        }
+        if (vma->end > start) {
+            return false;
+        }
+    }
+
+    struct vma *vma = malloc(sizeof *vma);
+    if (vma == NULL) {
+        return false;
+    }
+    vma->start = start;
+    vma->end = end;
+    vma->origin = origin;
+    vma->file = file;
+    vma->offset = offset;
+    vma->read_bytes = read_bytes;
+    vma->writable = writable;
+    list_init(&vma->pages);
+    list_insert(e, &vma->elem);
+    return true;
+}
+
+// returns the region containing PAGE, or NULL
+struct vma *page_table_find_vma(struct page_table *page_table, uint8_t *page) {
+    struct list_elem *e;
+    for (e = list_begin(&page_table->vmas); e != list_end(&page_table->vmas); e = list_next(e)) {
+        struct vma *vma = list_entry(e, struct vma, elem);
+        if (vma->start > page) {
+            break;
+        }
+        if (page < vma->end) {
+            return vma;
+        }
+    }
+    return NULL;
+}
+
+// removes the region starting at START; entries of its touched pages are kept, as outside any region
+void page_table_remove_vma(struct page_table *page_table, uint8_t *start) {
+    struct vma *vma = page_table_find_vma(page_table, start);
+    ASSERT(vma != NULL && vma->start == start);
+    if (!list_empty(&vma->pages)) {
+        list_splice(list_end(&page_table->loose), list_begin(&vma->pages), list_end(&vma->pages));
+    }
+    list_remove(&vma->elem);
+    free(vma);
+}
+
 struct page_table_entry *page_table_find(struct page_table *page_table, uint8_t *page) {
     #ifdef DEBUG
     printf("[page_table_find] page: %x\n", page);
@@ -116,6 +247,45 @@ struct page_table_entry *page_table_find(struct page_table *page_table, uint8_t
     return hash_entry(e, struct page_table_entry, hash_elem);
 }
 
+/*
+ * Returns the entry for PAGE, making it from the region containing
+ * PAGE if the page was not touched yet, or NULL if PAGE is not mapped
+ * or there is no memory for the entry.
+ */
+struct page_table_entry *page_table_lookup(struct page_table *page_table, uint8_t *page) {
+    struct page_table_entry *pte = page_table_find(page_table, page);
+    if (pte != NULL) {
+        return pte;
+    }
+
+    struct vma *vma = page_table_find_vma(page_table, page);
+    if (vma == NULL) {
+        return NULL;
+    }
+    uint32_t ofs = page - vma->start;
+    pte = page_table_entry_create();
+    if (pte == NULL) {
+        return NULL;
+    }
+    pte->page = page;
+    pte->file = vma->file;
+    pte->offset = vma->offset + ofs;
+    pte->read_bytes = ofs >= vma->read_bytes ? 0 : vma->read_bytes - ofs;
+    if (pte->read_bytes > PGSIZE) {
+        pte->read_bytes = PGSIZE;
+    }
+    pte->origin = vma->origin;
+    pte->writable = vma->writable;
+    page_table_attach(page_table, pte, vma);
+    hash_insert(&page_table->hash, &pte->hash_elem);
+    return pte;
+}
+
+// returns whether PAGE has an entry or is in a region
+bool page_table_contains(struct page_table *page_table, uint8_t *page) {
+    return page_table_find(page_table, page) != NULL || page_table_find_vma(page_table, page) != NULL;
+}
+
 void page_table_remove(struct page_table *page_table, uint8_t *page) {
   #ifdef DEBUG
   printf("[page_table_remove] page: %x\n", page);
@@ -124,6 +294,7 @@ void page_table_remove(struct page_table *page_table, uint8_t *page) {
   struct page_table_entry *pte = page_table_find(page_table, page);
   pagedir_clear_page(page_table->owner->thread->pagedir, page);
   hash_delete(&page_table->hash, &pte->hash_elem);
+  list_remove(&pte->vma_elem);
 
   free(pte);
 }
@@ -132,14 +303,13 @@ void page_table_entry_destroy(struct hash_elem *elem, void *aux) {
     struct page_table_entry *pte = hash_entry(elem, struct page_table_entry, hash_elem);
     if (pte->disk) {
       // swap
-      lock_acquire(&swap_lock);
-      bitmap_set(swap_table, pte->block / block_size, true);
-      lock_release(&swap_lock);
-    } else {
-      // frame
-      struct frame_table_entry *fte = frame_table_find(pte->frame);
-      hash_delete(&frame_table.hash, &fte->hash_elem);
-      free(fte);
+      swap_free(pte->block);
+    } else if (pte->frame) {
+      // frame, also unlinked from the clock unless other processes share it
+      frame_table_release(process_current(), pte->page, pte->frame);
+    } else if (pte->zero) {
+      // so that pagedir_destroy() does not free the shared zero page
+      pagedir_clear_page(process_current()->thread->pagedir, pte->page);
     }
     free(pte);
 }
@@ -150,6 +320,9 @@ void page_table_free(struct page_table *page_table) {
   #endif
 
   hash_destroy(&page_table->hash, page_table_entry_destroy);
+  while (!list_empty(&page_table->vmas)) {
+    free(list_entry(list_pop_front(&page_table->vmas), struct vma, elem));
+  }
 }
 
 /*
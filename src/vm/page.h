@@ -7,21 +7,52 @@
 #include "filesys/file.h"
 #include "filesys/inode.h"
 
+// where a page's contents come from when it is not in memory and was never written
+enum page_origin {
+	PAGE_ANON, // zeros (stack)
+	PAGE_ELF, // executable segment: read_bytes from file at offset, then zeros
+	PAGE_MMAP // memory mapped file, written back to it when dirty
+};
+
 struct page_table_entry {
 	uint8_t *page;
 	uint8_t *frame;
 	disk_sector_t block;
 	struct file *file;
 	off_t offset;
+	uint32_t read_bytes; // bytes to read from file, the rest of the page is zeroed
+
+	enum page_origin origin;
+	bool writable;
+	bool busy; // being paged in or written out without frame_table.lock; wait on frame_table.io_done
+	bool zero; // all zeros and only read so far: mapped read-only to frame_table.zero_page, frame is NULL
 
 	struct hash_elem hash_elem;
+	struct list_elem vma_elem; // in its region's pages, or in page_table.loose if outside any region
 
 	bool disk;  // indicates whether if the page is in disk
 };
 
+// a range of user pages with the same backing; its pages get entries only once touched
+struct vma {
+	uint8_t *start;
+	uint8_t *end; // one past the last page
+	enum page_origin origin; // PAGE_ELF or PAGE_MMAP
+	struct file *file;
+	off_t offset; // file offset of start
+	uint32_t read_bytes; // bytes of file mapped from start, the rest of the range is zeros
+	bool writable;
+	struct list pages; // entries of the pages touched so far
+
+	struct list_elem elem;
+};
+
 struct page_table {
 	struct process *owner;
-	struct hash hash;
+	struct hash hash; // pages that are or were in memory, and stack pages
+	struct list vmas; // struct vma, sorted by start
+	struct list loose; // entries of pages outside any region, i.e. the stack
+	int busy_cnt; // number of busy entries
 };
 
 /*
@@ -39,8 +70,15 @@ void page_table_init(struct page_table *page_table);
 
 void page_table_insert_frame(struct page_table *page_table, uint8_t *page, uint8_t *frame);
 void page_table_insert_block(struct page_table *page_table, uint8_t *page, disk_sector_t block);
-void page_table_insert_file(struct page_table *page_table, uint8_t *page, struct file *file, off_t offset);
+void page_table_insert_anon(struct page_table *page_table, uint8_t *page);
+struct page_table_entry *page_table_insert_copy(struct page_table *page_table, const struct page_table_entry *src);
+bool page_table_insert_vma(struct page_table *page_table, uint8_t *start, size_t page_cnt, enum page_origin origin,
+                           struct file *file, off_t offset, uint32_t read_bytes, bool writable);
+struct vma *page_table_find_vma(struct page_table *page_table, uint8_t *page);
+void page_table_remove_vma(struct page_table *page_table, uint8_t *start);
 struct page_table_entry *page_table_find(struct page_table *page_table, uint8_t *page);
+struct page_table_entry *page_table_lookup(struct page_table *page_table, uint8_t *page);
+bool page_table_contains(struct page_table *page_table, uint8_t *page);
 void page_table_remove(struct page_table *page_table, uint8_t *page);
 void page_table_free(struct page_table *page_table);
 
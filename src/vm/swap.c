@@ -1,19 +1,111 @@
 #include <bitmap.h>
 #include "vm/swap.h"
+#include <debug.h>
+#include <hash.h>
+#include <lz.h>
+#include <round.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
+#define SECTORS_PER_PAGE (PGSIZE / DISK_SECTOR_SIZE)
+
 /* The swap device */
 static struct disk *swap_device;
 
 /* Tracks in-use and free swap slots */
 struct bitmap *swap_table;
 
-/* Protects swap_table */
+/* Slots with a disk transfer in flight, which read-ahead must not touch */
+static struct bitmap *swap_busy;
+
+/* Protects swap_table, swap_busy, swap_cursor, swap_reqs, swap_cache
+   and zswap.  Held only to allocate slots and update the caches, never
+   across disk I/O. */
 struct lock swap_lock;
 
 const int block_size = PGSIZE / DISK_SECTOR_SIZE;
 
+/* Next-fit allocation: slots are searched from where the last
+   allocation ended, so consecutive swap-outs land next to each
+   other on disk and the slots at the front are not rescanned. */
+static size_t swap_cursor;
+
+/* Requests for swap_out_multiple() and swap_in() batches, too many
+   for the stack.  Each transfer takes one of SWAP_IO_MAX arrays, so
+   that many page-ins and page-outs can be at the disk at once.  A
+   batch is up to SWAP_CLUSTER pages plus as many zswap write-backs. */
+#define SWAP_IO_MAX 4
+#define SWAP_IO_REQS (2 * SWAP_CLUSTER * SECTORS_PER_PAGE)
+static struct disk_request swap_reqs[SWAP_IO_MAX][SWAP_IO_REQS];
+static bool swap_reqs_used[SWAP_IO_MAX];
+
+/* Signaled when a transfer finishes: a request array is free, a
+   read-ahead is in the cache or a zswap write-back is on disk */
+static struct condition swap_io_done;
+
+/* Swap read-ahead: swap_in() also reads up to SWAP_READAHEAD in-use
+   slots following the faulting one, which were likely swapped out in
+   the same batch, into the swap cache.  A later fault on one of them
+   is a copy instead of a disk read.  Entries are replaced round-robin,
+   and dropped when their slot is read or freed. */
+#define SWAP_READAHEAD 3
+#define SWAP_CACHE_SIZE (2 * SWAP_READAHEAD)
+
+struct swap_cache_entry {
+    disk_sector_t block;
+    uint8_t *page; // kernel page holding a copy of the slot
+    bool valid;
+    bool loading; // valid, but still being read into page
+};
+static struct swap_cache_entry swap_cache[SWAP_CACHE_SIZE];
+static size_t swap_cache_next; // next entry to replace
+
+/* Compressed swap (zswap): swap_out_multiple() compresses each page
+   into a pool of kernel pages instead of writing it to its slot, and
+   swap_in() decompresses it back.  The slot is still allocated, so
+   when the pool fills, pages that do not fit go to disk and the oldest
+   pages in the pool are written to their slots in the same batch, to
+   make room.  Pages that compress worse than ZSWAP_MAX_SIZE go
+   straight to disk.
+
+   Pool pages are split into ZSWAP_CHUNK-byte chunks, and a compressed
+   page takes a run of chunks in one pool page.
+
+   Pages are compressed without swap_lock, into scratch memory of the
+   caller's own; the lock is only taken to place the result in the
+   pool. */
+#define ZSWAP_CHUNK 64
+#define ZSWAP_CHUNKS_PER_PAGE (PGSIZE / ZSWAP_CHUNK)
+#define ZSWAP_MAX_SIZE (PGSIZE * 3 / 4)
+#define ZSWAP_SCRATCH_PAGES DIV_ROUND_UP(ZSWAP_MAX_SIZE + LZ_WORK_SIZE, PGSIZE) // output, then work memory
+#define ZSWAP_POOL_FRACTION 8 // the pool grows to at most this fraction of the kernel pool
+
+struct zswap_page {
+    uint8_t *kpage; // NULL until first needed
+    struct bitmap *chunks; // chunks in use
+};
+
+struct zswap_entry {
+    disk_sector_t block; // swap slot the page belongs to
+    size_t size; // compressed bytes
+    struct zswap_page *zpage;
+    size_t chunk; // first chunk in zpage
+    bool writeback; // being written to its slot; freed once on disk
+    struct hash_elem hash_elem;
+    struct list_elem list_elem; // in zswap_lru, oldest first
+};
+
+static struct zswap_page *zswap_pool;
+static size_t zswap_pool_size;
+static struct hash zswap_hash; // struct zswap_entry by block
+static struct list zswap_lru;
+
+static unsigned zswap_hash_func(const struct hash_elem *e, void *aux);
+static bool zswap_less_func(const struct hash_elem *a, const struct hash_elem *b, void *aux);
+
 /*
  * Initialize swap_device, swap_table, and swap_lock.
  */
@@ -24,10 +116,238 @@ swap_table_init (void)
     printf("[swap_table_init]\n");
     #endif
 
-    swap_device = disk_get(1, 1);
+    swap_device = disk_get_role(DISK_SWAP);
     ASSERT(swap_device != NULL);
     swap_table = bitmap_create(disk_size(swap_device) / block_size);
+    swap_busy = bitmap_create(disk_size(swap_device) / block_size);
+    ASSERT(swap_table != NULL && swap_busy != NULL);
     lock_init(&swap_lock);
+    cond_init(&swap_io_done);
+    swap_cursor = 0;
+
+    size_t i;
+    for (i=0; i<SWAP_CACHE_SIZE; i++) {
+        swap_cache[i].page = palloc_get_page(PAL_ASSERT);
+        swap_cache[i].valid = false;
+        swap_cache[i].loading = false;
+    }
+    swap_cache_next = 0;
+
+    zswap_pool_size = palloc_page_count(0) / ZSWAP_POOL_FRACTION;
+    zswap_pool = calloc(zswap_pool_size, sizeof *zswap_pool);
+    ASSERT(zswap_pool != NULL);
+    hash_init(&zswap_hash, zswap_hash_func, zswap_less_func, NULL);
+    list_init(&zswap_lru);
+}
+
+static unsigned
+zswap_hash_func (const struct hash_elem *e, void *aux UNUSED)
+{
+    const struct zswap_entry *z = hash_entry(e, struct zswap_entry, hash_elem);
+    return hash_int(z->block);
+}
+
+static bool
+zswap_less_func (const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+    return hash_entry(a, struct zswap_entry, hash_elem)->block
+           < hash_entry(b, struct zswap_entry, hash_elem)->block;
+}
+
+// returns the compressed copy of slot BLOCK, or NULL if it is on disk; swap_lock must be held
+static struct zswap_entry *
+zswap_find (disk_sector_t block)
+{
+    struct zswap_entry key;
+    key.block = block;
+    struct hash_elem *e = hash_find(&zswap_hash, &key.hash_elem);
+    return e != NULL ? hash_entry(e, struct zswap_entry, hash_elem) : NULL;
+}
+
+// frees the pool chunks and bookkeeping of Z
+static void
+zswap_drop (struct zswap_entry *z)
+{
+    bitmap_set_multiple(z->zpage->chunks, z->chunk, DIV_ROUND_UP(z->size, ZSWAP_CHUNK), false);
+    hash_delete(&zswap_hash, &z->hash_elem);
+    list_remove(&z->list_elem);
+    free(z);
+}
+
+// decompresses Z into PAGE
+static void
+zswap_decompress (struct zswap_entry *z, uint8_t *page)
+{
+    size_t size = lz_decompress(z->zpage->kpage + z->chunk * ZSWAP_CHUNK, z->size, page, PGSIZE);
+    ASSERT(size == PGSIZE);
+}
+
+// returns the oldest compressed page not being written back, or NULL
+static struct zswap_entry *
+zswap_oldest (void)
+{
+    struct list_elem *e;
+    for (e = list_begin(&zswap_lru); e != list_end(&zswap_lru); e = list_next(e)) {
+        struct zswap_entry *z = list_entry(e, struct zswap_entry, list_elem);
+        if (!z->writeback) {
+            return z;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Finds CNT free chunks in one pool page, growing the pool if none
+ * has room.  Returns the pool page and stores the first chunk in
+ * *CHUNK, or returns NULL if the pool is full.
+ */
+static struct zswap_page *
+zswap_alloc (size_t cnt, size_t *chunk)
+{
+    size_t i;
+    for (i=0; i<zswap_pool_size; i++) {
+        struct zswap_page *zp = &zswap_pool[i];
+        if (zp->kpage == NULL) {
+            zp->kpage = palloc_get_page(0);
+            if (zp->kpage == NULL) {
+                return NULL;
+            }
+            zp->chunks = bitmap_create(ZSWAP_CHUNKS_PER_PAGE);
+            if (zp->chunks == NULL) {
+                palloc_free_page(zp->kpage);
+                zp->kpage = NULL;
+                return NULL;
+            }
+        }
+        *chunk = bitmap_scan_and_flip(zp->chunks, 0, cnt, false);
+        if (*chunk != BITMAP_ERROR) {
+            return zp;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Compresses PAGE into SCRATCH, ZSWAP_SCRATCH_PAGES pages of the
+ * caller's.  Returns the compressed size, or 0 if the page does not
+ * compress well enough.  Needs no lock.
+ */
+static size_t
+zswap_compress (const uint8_t *page, uint8_t *scratch)
+{
+    return lz_compress(page, PGSIZE, scratch, ZSWAP_MAX_SIZE, scratch + ZSWAP_MAX_SIZE);
+}
+
+/*
+ * Stores the SIZE bytes of DATA, a page compressed by zswap_compress(),
+ * in the pool as the contents of slot BLOCK.  Returns false, setting
+ * *FULL if the pool has no room, if the page must be written to its
+ * slot instead.  swap_lock must be held.
+ */
+static bool
+zswap_store (disk_sector_t block, const uint8_t *data, size_t size, bool *full)
+{
+    *full = false;
+    struct zswap_entry *z = malloc(sizeof *z);
+    if (z == NULL) {
+        return false;
+    }
+
+    z->zpage = zswap_alloc(DIV_ROUND_UP(size, ZSWAP_CHUNK), &z->chunk);
+    if (z->zpage == NULL) {
+        *full = true;
+        free(z);
+        return false;
+    }
+    memcpy(z->zpage->kpage + z->chunk * ZSWAP_CHUNK, data, size);
+    z->block = block;
+    z->size = size;
+    z->writeback = false;
+    hash_insert(&zswap_hash, &z->hash_elem);
+    list_push_back(&zswap_lru, &z->list_elem);
+    return true;
+}
+
+// returns the swap cache entry holding BLOCK, or NULL; swap_lock must be held
+static struct swap_cache_entry *
+swap_cache_find (disk_sector_t block)
+{
+    size_t i;
+    for (i=0; i<SWAP_CACHE_SIZE; i++) {
+        if (swap_cache[i].valid && swap_cache[i].block == block) {
+            return &swap_cache[i];
+        }
+    }
+    return NULL;
+}
+
+// takes a free array of swap requests, waiting for one; swap_lock must be held
+static struct disk_request *
+swap_reqs_get (void)
+{
+    for (;;) {
+        size_t i;
+        for (i=0; i<SWAP_IO_MAX; i++) {
+            if (!swap_reqs_used[i]) {
+                swap_reqs_used[i] = true;
+                return swap_reqs[i];
+            }
+        }
+        cond_wait(&swap_io_done, &swap_lock);
+    }
+}
+
+// returns REQS from swap_reqs_get(); swap_lock must be held
+static void
+swap_reqs_put (struct disk_request *reqs)
+{
+    swap_reqs_used[(reqs - swap_reqs[0]) / SWAP_IO_REQS] = false;
+    cond_broadcast(&swap_io_done, &swap_lock);
+}
+
+// adds requests to transfer slot BLOCK to or from BUFFER to REQS from index N; returns the new N
+static size_t
+swap_reqs_add (struct disk_request *reqs, size_t n, disk_sector_t block, uint8_t *buffer, bool write,
+               enum disk_tag tag, struct semaphore *done)
+{
+    size_t j;
+    for (j=0; j<SECTORS_PER_PAGE; j++, n++) {
+        disk_request_init(&reqs[n], swap_device, block + j, buffer + j * DISK_SECTOR_SIZE,
+                          write, disk_request_wake, done);
+        reqs[n].tag = tag;
+    }
+    return n;
+}
+
+// submits the N requests in REQS and waits for all of them
+static void
+swap_reqs_run (struct disk_request *reqs, size_t n, struct semaphore *done)
+{
+    size_t i;
+    if (n > 0) {
+        disk_submit_batch(reqs, n);
+    }
+    for (i=0; i<n; i++) {
+        sema_down(done);
+    }
+}
+
+/*
+ * Allocate CNT contiguous swap slots, next-fit from swap_cursor.
+ * Returns the first slot, or BITMAP_ERROR if there is no such run.
+ * swap_lock must be held.
+ */
+static size_t
+slot_alloc (size_t cnt)
+{
+    size_t slot = bitmap_scan_and_flip(swap_table, swap_cursor, cnt, false);
+    if (slot == BITMAP_ERROR && swap_cursor != 0) {
+        slot = bitmap_scan_and_flip(swap_table, 0, cnt, false);
+    }
+    if (slot != BITMAP_ERROR) {
+        swap_cursor = (slot + cnt) % bitmap_size(swap_table);
+    }
+    return slot;
 }
 
 /*
@@ -49,15 +369,70 @@ swap_in (disk_sector_t block, uint8_t *frame)
     printf("[swap_in] block: %u, frame: %x\n", block, frame);
     #endif
 
-    // prevent concurrent disk access
+    struct semaphore done;
+    struct swap_cache_entry *ahead[SWAP_READAHEAD];
+    size_t slot = block / block_size;
+    size_t i, n = 0, ahead_cnt = 0;
+    bool hit = false;
+
     lock_acquire(&swap_lock);
-    int i;
-    for (i=0; i<block_size; i++) {
-        disk_read(swap_device, block + i, frame + i * DISK_SECTOR_SIZE);
+    for (;;) {
+        struct zswap_entry *z = zswap_find(block);
+        struct swap_cache_entry *e = swap_cache_find(block);
+        if (z != NULL && !z->writeback) {
+            zswap_decompress(z, frame);
+            zswap_drop(z);
+            hit = true;
+            break;
+        }
+        if (e != NULL && !e->loading) {
+            // read ahead earlier
+            memcpy(frame, e->page, PGSIZE);
+            e->valid = false;
+            hit = true;
+            break;
+        }
+        if (z == NULL && e == NULL) {
+            break;
+        }
+        // on its way to or from the disk in another thread
+        cond_wait(&swap_io_done, &swap_lock);
     }
-    bitmap_set(swap_table, block / block_size, false);
-    lock_release(&swap_lock);
 
+    if (!hit) {
+        // keep read-ahead elsewhere off the slot while we read it
+        bitmap_mark(swap_busy, slot);
+        struct disk_request *reqs = swap_reqs_get();
+        sema_init(&done, 0);
+        n = swap_reqs_add(reqs, n, block, frame, false, DISK_TAG_SWAP, &done);
+        // neighbours in use and only on disk, read in the same batch
+        for (i=1; i<=SWAP_READAHEAD && slot + i < bitmap_size(swap_table); i++) {
+            disk_sector_t next = (slot + i) * block_size;
+            struct swap_cache_entry *c = &swap_cache[swap_cache_next];
+            if (!bitmap_test(swap_table, slot + i) || bitmap_test(swap_busy, slot + i)
+                || swap_cache_find(next) != NULL || zswap_find(next) != NULL || c->loading) {
+                break;
+            }
+            swap_cache_next = (swap_cache_next + 1) % SWAP_CACHE_SIZE;
+            c->block = next;
+            c->valid = true;
+            c->loading = true;
+            ahead[ahead_cnt++] = c;
+            n = swap_reqs_add(reqs, n, next, c->page, false, DISK_TAG_READAHEAD, &done);
+        }
+        lock_release(&swap_lock);
+
+        swap_reqs_run(reqs, n, &done);
+
+        lock_acquire(&swap_lock);
+        for (i=0; i<ahead_cnt; i++) {
+            ahead[i]->loading = false;
+        }
+        bitmap_reset(swap_busy, slot);
+        swap_reqs_put(reqs);
+    }
+    bitmap_set(swap_table, slot, false);
+    lock_release(&swap_lock);
 }
 
 /*
@@ -77,21 +452,200 @@ swap_in (disk_sector_t block, uint8_t *frame)
 disk_sector_t
 swap_out (uint8_t *frame)
 {
+    disk_sector_t block;
+    swap_out_multiple(&frame, 1, &block);
+    return block;
+}
+
+/*
+ * Write the CNT pages in FRAMES to swap as one batch, storing the
+ * slot of each in BLOCKS.  The pages get a contiguous cluster of slots
+ * when there is one, so that the disk sees a single sequential write.
+ * Pages that compress are kept in the zswap pool and not written.
+ */
+void
+swap_out_multiple (uint8_t *frames[], size_t cnt, disk_sector_t blocks[])
+{
+    struct semaphore done;
+    struct zswap_entry *victims[SWAP_CLUSTER];
+    uint8_t *buffers[SWAP_CLUSTER];
+    size_t i, n = 0, victim_cnt = 0;
+    bool written[SWAP_CLUSTER];
+    // without scratch memory, every page is written to its slot
+    uint8_t *scratch = palloc_get_multiple(0, ZSWAP_SCRATCH_PAGES);
+
     #ifdef DEBUG
-    printf("[swap_out] frame: %x\n", frame);
+    printf("[swap_out_multiple] cnt: %u\n", cnt);
     #endif
 
+    ASSERT(cnt <= SWAP_CLUSTER);
+
+    sema_init(&done, 0);
+    lock_acquire(&swap_lock);
+    struct disk_request *reqs = swap_reqs_get();
+    size_t slot = slot_alloc(cnt);
+    for (i=0; i<cnt; i++) {
+        if (slot != BITMAP_ERROR) {
+            blocks[i] = (slot + i) * block_size;
+        } else {
+            // swap fragmented: scatter the pages
+            size_t single = slot_alloc(1);
+            if (single == BITMAP_ERROR) {
+                PANIC("swap is full");
+            }
+            blocks[i] = single * block_size;
+        }
+        // keeps read-ahead off the slot until its page is stored or written
+        bitmap_mark(swap_busy, blocks[i] / block_size);
+    }
+    lock_release(&swap_lock);
+
+    for (i=0; i<cnt; i++) {
+        size_t size = scratch != NULL ? zswap_compress(frames[i], scratch) : 0;
+        bool full = false;
+
+        lock_acquire(&swap_lock);
+        written[i] = size == 0 || !zswap_store(blocks[i], scratch, size, &full);
+        if (!written[i]) {
+            bitmap_reset(swap_busy, blocks[i] / block_size);
+            lock_release(&swap_lock);
+            continue;
+        }
+        n = swap_reqs_add(reqs, n, blocks[i], frames[i], true, DISK_TAG_SWAP, &done);
+
+        // pool full: write its oldest page back too, to make room for the next ones
+        struct zswap_entry *z = full ? zswap_oldest() : NULL;
+        uint8_t *buffer = z != NULL ? palloc_get_page(0) : NULL;
+        if (buffer != NULL) {
+            zswap_decompress(z, buffer);
+            z->writeback = true;
+            victims[victim_cnt] = z;
+            buffers[victim_cnt++] = buffer;
+            n = swap_reqs_add(reqs, n, z->block, buffer, true, DISK_TAG_SWAP, &done);
+        }
+        lock_release(&swap_lock);
+    }
+    if (scratch != NULL) {
+        palloc_free_multiple(scratch, ZSWAP_SCRATCH_PAGES);
+    }
+
+    swap_reqs_run(reqs, n, &done);
+
     lock_acquire(&swap_lock);
-    size_t temp = bitmap_scan_and_flip(swap_table, 0, 1, false);
+    for (i=0; i<cnt; i++) {
+        if (written[i]) {
+            bitmap_reset(swap_busy, blocks[i] / block_size);
+        }
+    }
+    for (i=0; i<victim_cnt; i++) {
+        zswap_drop(victims[i]);
+        palloc_free_page(buffers[i]);
+    }
+    swap_reqs_put(reqs);
+    lock_release(&swap_lock);
+}
+
+/*
+ * Release swap slot BLOCK of a page that is no longer needed.
+ */
+void
+swap_free (disk_sector_t block)
+{
+    struct swap_cache_entry *e;
+    struct zswap_entry *z;
+
+    lock_acquire(&swap_lock);
+    for (;;) {
+        e = swap_cache_find(block);
+        z = zswap_find(block);
+        if ((e == NULL || !e->loading) && (z == NULL || !z->writeback)) {
+            break;
+        }
+        // the slot must not be reused before the transfer is done
+        cond_wait(&swap_io_done, &swap_lock);
+    }
+    if (e != NULL) {
+        e->valid = false;
+    }
+    if (z != NULL) {
+        zswap_drop(z);
+    }
+    bitmap_set(swap_table, block / block_size, false);
+    lock_release(&swap_lock);
+}
+
+/*
+ * Copy the page in swap slot BLOCK to a new slot, stored in *COPY,
+ * for a forked child.  Returns false if no kernel page is free to
+ * copy through.
+ */
+bool
+swap_copy (disk_sector_t block, disk_sector_t *copy)
+{
+    #ifdef DEBUG
+    printf("[swap_copy] block: %u\n", block);
+    #endif
+
+    uint8_t *buffer = palloc_get_page(0);
+    if (buffer == NULL) {
+        return false;
+    }
+
+    bool on_disk = false, full;
+    uint8_t *scratch;
+    size_t size;
+
+    lock_acquire(&swap_lock);
+    for (;;) {
+        struct zswap_entry *z = zswap_find(block);
+        struct swap_cache_entry *e = swap_cache_find(block);
+        if (z != NULL) {
+            // intact until dropped, even while being written back
+            zswap_decompress(z, buffer);
+            break;
+        }
+        if (e != NULL && !e->loading) {
+            memcpy(buffer, e->page, PGSIZE);
+            break;
+        }
+        if (e == NULL) {
+            on_disk = true;
+            break;
+        }
+        cond_wait(&swap_io_done, &swap_lock);
+    }
+    lock_release(&swap_lock);
+
+    // the slot stays allocated to the parent, which waits for the fork
+    if (on_disk) {
+        disk_read_multiple(swap_device, block, block_size, buffer, DISK_TAG_SWAP);
+    }
+
+    scratch = palloc_get_multiple(0, ZSWAP_SCRATCH_PAGES);
+    size = scratch != NULL ? zswap_compress(buffer, scratch) : 0;
+
+    lock_acquire(&swap_lock);
+    size_t temp = slot_alloc(1);
     if (temp == BITMAP_ERROR) {
-        // kernel panic
+        PANIC("swap is full");
     }
-    disk_sector_t block = temp * block_size;
-    int i;
-    for (i=0; i<block_size; i++) {
-        disk_write(swap_device, block + i, frame + i * DISK_SECTOR_SIZE);
+    *copy = temp * block_size;
+    bool stored = size > 0 && zswap_store(*copy, scratch, size, &full);
+    if (!stored) {
+        bitmap_mark(swap_busy, temp);
     }
     lock_release(&swap_lock);
+    if (scratch != NULL) {
+        palloc_free_multiple(scratch, ZSWAP_SCRATCH_PAGES);
+    }
 
-    return block;
+    if (!stored) {
+        disk_write_multiple(swap_device, *copy, block_size, buffer, DISK_TAG_SWAP);
+        lock_acquire(&swap_lock);
+        bitmap_reset(swap_busy, temp);
+        lock_release(&swap_lock);
+    }
+
+    palloc_free_page(buffer);
+    return true;
 }
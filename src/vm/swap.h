@@ -3,9 +3,15 @@
 
 #include "devices/disk.h"
 
+// most pages swap_out_multiple() writes as one batch
+#define SWAP_CLUSTER 8
+
 void swap_table_init (void);
 
 void swap_in(disk_sector_t block, uint8_t *frame);
 disk_sector_t swap_out(uint8_t *frame);
+void swap_out_multiple(uint8_t *frames[], size_t cnt, disk_sector_t blocks[]);
+void swap_free(disk_sector_t block);
+bool swap_copy(disk_sector_t block, disk_sector_t *copy);
 
 #endif /* vm/swap.h */